@@ -1,6 +1,8 @@
 #ifndef BALLS_H
 #define BALLS_H
 
+// The headless build (BALLS_HEADLESS) never calls into raylib and links without it, everything that needs a
+// window is left out. The world is stepped by an explicit dt there and only raylib's plain structs are used.
 #include "raylib.h"
 
 #define RL_COLOR_TYPE
@@ -11,10 +13,29 @@
 #define RL_QUATERNION_TYPE
 #define RL_MATRIX_TYPE
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 
+#include "commandQueue.hpp"
+#include "frameArena.hpp"
+#include "idMap.hpp"
+#include "pageResource.hpp"
 #include "raymath.h"
+#include "taskGraph.hpp"
+#include "threadPool.hpp"
+#include "tripleBuffer.hpp"
 
 template <typename T>
 struct Vec2 {
@@ -65,11 +86,15 @@ class Ball {
 
     Ball(int id, int radius, float mass, Color color, Vector2 pos, Vector2 vel, Vector2 acc);
 
-    void update(void);
+    void update(float dt);
     void forceUpdate(void);
     void toggleUpdate(void);
 
+#ifndef BALLS_HEADLESS
+    // by the frame time
+    void update(void);
     void draw(void);
+#endif
 
     // returns the coordinates of the top, right, bottom, and left sides of the ball in order
     Vec4<Vec2<float>> getBounds(void) const;
@@ -77,31 +102,363 @@ class Ball {
     bool isCollidingWith(Ball& other) const;
 };
 
+// What balls of the same type have in common, a world keeps a table of them and each of its balls refers to
+// one by a single byte
+struct BallMaterial {
+    int radius;
+    float mass;
+    Color color;
+};
+
+// The part of a ball the step goes over every time, kept small so that many of them fit in the cache. The
+// id and the material are looked up elsewhere when they are needed.
+#ifndef BALLS_COMPACT
+struct BallBody {
+    Vector2 pos;
+    Vector2 vel;
+    uint8_t material;
+    bool shouldUpdate;
+};
+#else
+// The compact build squeezes a body into 14 bytes for scenes too big for the cache either way: the position
+// is the ball's cell plus a 16 bit fixed point offset inside it, and the velocity is a pair of half floats.
+// Go through CollidingWorld's getPosition and friends instead of reading them directly.
+struct BallBody {
+    uint16_t cell[2];
+    uint16_t offset[2];
+    uint16_t vel[2];
+    uint8_t material;
+    bool shouldUpdate;
+};
+#endif
+
+// what draw() needs to know about a ball, gathered at the end of every update
+struct BallSprite {
+    Vector2 pos;
+    float radius;
+    Color color;
+};
+
+// Refers to a ball of a world for as long as the ball is in it, and to nothing once it is removed, even after
+// its slot goes to a later ball. Unlike a Ball* it stays safe to hold on to across steps.
+struct BallHandle {
+    uint32_t index = UINT32_MAX;
+    uint32_t generation = 0;
+};
+
 enum BallSelectionType {
     Drag,
     Shoot
 };
 
+// where a step's time went and how much collision work it did
+struct StepStats {
+    // Seconds of the step's graph, which goes through three phases one after the other: integrating until the
+    // cells are built, building them, and the collisions along with the sprites of the snapshot.
+    float integrate;
+    float buildCells;
+    float collide;
+    // the whole step, the queued commands included
+    float step;
+    // ordered pairs of balls that were compared, and the ones of them that overlapped
+    uint64_t pairsTested;
+    uint64_t contacts;
+    // memoryFootprint().total() at the end of the step
+    size_t memory;
+    // getSubstitutedCount() at the end of the step
+    size_t substituted;
+};
+
+// Copy of everything the render loop needs from a world, published after every update so drawing never
+// touches the balls while they are being stepped
+struct WorldSnapshot {
+    // the arrays go on memory, a world puts them on the same pages as its balls
+    explicit WorldSnapshot(std::pmr::memory_resource* memory = std::pmr::get_default_resource())
+        : sprites(memory), cellStart(memory) {}
+
+    // one per ball, cell by cell through the grid so drawing them in order walks the world once
+    std::pmr::vector<BallSprite> sprites;
+    // Where each cell of the grid starts in sprites, row by row, and at the end where the balls outside the
+    // grid start. The part of a row in view is one run of sprites, and a cell's count is how crowded it is.
+    std::pmr::vector<uint32_t> cellStart;
+    int ballCount = 0;
+    int lastId = -1;
+    bool updating = false;
+    // only set while a ball is selected
+    bool hasSelected = false;
+    Vector2 selectedPos = {};
+    BallSelectionType selectionType = {};
+    StepStats stats = {};
+};
+
+// bytes a world holds on to, see CollidingWorld::memoryFootprint
+struct WorldMemory {
+    // bodies, ids, slots, the id map and the material table
+    size_t balls;
+    // the sorted cells and what it takes to build them
+    size_t cells;
+    // per-thread scratch the collision pass gathers each neighbourhood's candidates into
+    size_t contacts;
+    // the command queue and the scratch of the stepping thread
+    size_t scratch;
+    // the sprites and cell starts of the three snapshots
+    size_t snapshots;
+
+    size_t total(void) const { return balls + cells + contacts + scratch + snapshots; }
+};
+
+// change to a world that any thread can queue, the world applies them at the start of its next step
+struct WorldCommand {
+    enum Type {
+        Add,
+        Remove,
+        AddBatch,
+        RemoveBatch,
+        RemoveIf,
+        Impulse,
+        Drag,
+        Select,
+        Unselect,
+        ToggleUpdate,
+    } type;
+    // the ball the command is about, unused by Add, Select, Unselect and ToggleUpdate
+    int id;
+    // the impulse for Impulse, the target for Drag and the mouse position for Select
+    Vector2 vec;
+    BallSelectionType selectionType;
+    std::optional<Ball> ball;
+    // What the batch commands carry. It is kept out of line so that the slots of the queue, which are all
+    // allocated up front, stay small.
+    struct Batch {
+        std::vector<Ball> balls;
+        std::vector<int> ids;
+        std::function<bool(Ball const&)> predicate;
+    };
+    std::unique_ptr<Batch> batch;
+};
+
+// how a world is set up besides its size
+struct WorldOptions {
+    // threads that step the world, 0 uses every core
+    unsigned threadCount = 0;
+    // PageSize::Huge keeps the balls and cells on huge pages, see the CollidingWorld constructor
+    PageSize pageSize = PageSize::Normal;
+    // commands that can wait for the next step, their slots are allocated up front
+    size_t commandCapacity = 1 << 14;
+    // Steps on this pool instead of starting one of its own, threadCount is ignored then. It has to outlive the
+    // world, and other worlds can share it.
+    ThreadPool* pool = nullptr;
+    // a world that is never drawn can skip building snapshots, getSnapshot() then stays empty
+    bool publishSnapshots = true;
+    // Keeps cells for only gridRows rows of the grid from firstRow on, 0 keeps every row. Balls outside of them
+    // still move and bounce off the world's walls, they just collide with nothing and are drawn as if
+    // outside the grid. For a world that is one part of a bigger one, see StripDomain.
+    int firstRow = 0;
+    int gridRows = 0;
+};
+
 // World class that checks for collisions using spatial hashing
 class CollidingWorld {
    private:
-    std::unordered_map<Vec2<int>, std::vector<Ball*>> cells;
-    std::vector<Ball> balls;
-    int selectedBall;
+    // where the arrays that grow with the ball count live, declared first so it outlives them
+    PageResource pages;
+    // The cells are stored row by row as one sorted array: the balls of cell k are the indices
+    // cellBalls[cellStart[k]] up to cellBalls[cellStart[k + 1]], in the order they have in `balls`.
+    std::pmr::vector<uint32_t> cellBalls{&pages};
+    std::pmr::vector<uint32_t> cellStart{&pages};
+    // scratch for buildCells, the cell of every ball and a counter per cell that is zero between rebuilds
+    std::pmr::vector<uint32_t> ballCells{&pages};
+    std::pmr::vector<uint32_t> cellCounts{&pages};
+    // where each block of cells starts in cellBalls, for the prefix sum
+    std::vector<uint32_t> blockStart;
+    // Balls are stored as their bodies, with the ids in a separate array alongside. Radius, mass and colour
+    // come from the material table, materialRadii is its radii as floats for the integrator. materialUses
+    // counts the balls of every material, one that drops to 0 is free for the next new material.
+    std::pmr::vector<BallBody> balls{&pages};
+    std::pmr::vector<int> ballIds{&pages};
+    std::vector<BallMaterial> materials;
+    std::vector<uint32_t> materialUses;
+    float materialRadii[256];
+    // Handles point at slots, and a slot knows where its ball currently is in `balls`. Removing a ball moves
+    // the last one into its place, so ballSlots maps back from balls to slots. A slot is reused with the next
+    // generation once its ball is gone, and idSlots finds the slot of a ball id.
+    struct Slot {
+        uint32_t ball;
+        uint32_t generation;
+    };
+    std::vector<Slot> slots;
+    std::vector<uint32_t> freeSlots;
+    std::pmr::vector<uint32_t> ballSlots{&pages};
+    IdMap idSlots;
+    // set by reserve() with hardCapacity, new balls past it are dropped instead of growing anything
+    size_t capacity;
+    bool hardCapacity;
+    size_t dropped;
+    // balls that were given the closest material there was because all 256 were in use
+    size_t substituted;
+    BallHandle selected;
     BallSelectionType selectionType;
     int cellSize;
     Vec2<int> worldConstraint;
     bool shouldUpdate;
     int lastId;
-    Ball* shooter;
+    // ball that was let go of in shoot mode, it is fired at the start of the next update
+    BallHandle shooter;
+    // the pool the world was given in its options, or else one of its own
+    std::unique_ptr<ThreadPool> ownPool;
+    ThreadPool* pool;
+    bool publishing;
+    // scratch memory of a step, a slot per pool thread and one for the thread that steps the world
+    FrameArena arena;
+
+    // update runs as a graph of input -> integrate chunks -> buildCells -> collide rows -> sprite rows, built
+    // once in the constructor. The arguments of the running update are kept here for the nodes to read.
+    TaskGraph frame;
+    Vector2 frameMouse;
+    float frameDt;
+    bool frameCollide;
+    // number of cell rows and columns, the inclusive edge cells count too, and the world's row that is the
+    // grid's first. The grid only covers part of the world with WorldOptions::gridRows.
+    Vec2<int> gridSize;
+    int firstRow;
+    // when the buildCells node of the running step started and finished, the phases of StepStats split there
+    std::chrono::steady_clock::time_point buildStart;
+    std::chrono::steady_clock::time_point buildEnd;
+    // Collision work of the running step for every pool slot and the stepping thread. Every slot has a cache
+    // line of its own, so the threads count without sharing anything.
+    struct alignas(64) CollisionCounters {
+        uint64_t pairs;
+        uint64_t contacts;
+    };
+    std::vector<CollisionCounters> collisionCounters;
+    // the sprite rows write straight into the back snapshot, row r starts at cellStart[r * gridSize.x]
+    TripleBuffer<WorldSnapshot> snapshots;
+
+    // Everything that changes the world from outside goes through `commands`, so it is safe from any thread
+    // and is applied in one go at the start of a step. While the simulation thread runs the render loop's
+    // mouse position travels through `pointer`, and everything else in the world belongs to that thread.
+    struct Pointer {
+        Vector2 mouse;
+        bool checkCollision;
+    };
+    CommandQueue<WorldCommand> commands;
+    // held for the whole of a step, a sender that finds the queue full and can take it applies the queue itself
+    std::mutex stepping;
+    // the thread holding `stepping`, which cannot wait for a full queue as nobody else would empty it
+    std::atomic<std::thread::id> stepper;
+    // commands the stepping thread sent while the queue was full, applied after the queue by the next step
+    std::vector<WorldCommand> overflow;
+    std::thread simulation;
+    std::atomic<bool> simulating;
+    TripleBuffer<Pointer> pointer;
+
+    // a ball of the neighbourhood resolveCollisions works on
+    struct Candidate {
+        BallBody* body;
+        Vector2 pos;
+        float radius;
+        bool moved;
+    };
+
+    // balls of one cell, a slice of cellBalls
+    struct CellRange {
+        uint32_t const* first;
+        uint32_t const* last;
+        uint32_t const* begin(void) const { return first; }
+        uint32_t const* end(void) const { return last; }
+    };
 
     Vec2<int> hash(Vector2 position) const;
+    CellRange getCell(Vec2<int> cell) const;
+    // fills coords with the valid cells of the 3x3 neighbourhood of pos and returns how many there are
+    int getRelatedCoords(Vec2<int> pos, Vec2<int> (&coords)[9]);
+
+    void buildFrameGraph(void);
+    void applyInput(void);
+    void integrateChunk(size_t chunk, size_t chunks);
+    void collideRow(int row);
+    void prepareRow(int row);
+    BallSprite spriteOf(BallBody const& ball) const;
+    void step(float dt);
+    void publishSnapshot(void);
+
+    void send(WorldCommand command);
+    void applyCommands(void);
+    void applyCommand(WorldCommand& command);
+    void simulate(int stepsPerSecond);
+
+    void insertBall(Ball const& ball);
+    void insertBalls(std::vector<Ball> const& balls);
+    void eraseBall(int id);
+    BallBody* findBall(int id);
+    // The material of ball's radius, mass and colour, counted as used once more. It is added to the table if it
+    // is not there yet, and once all 256 are in use the closest one stands in for it.
+    uint8_t internMaterial(Ball const& ball);
+    void releaseMaterial(uint8_t material);
+    void select(Vector2 mousePos, BallSelectionType type);
+    void unselect(void);
 
    public:
-    CollidingWorld(int cellSize, Vec2<int> worldConstraint);
+    // threadCount is the number of threads that step the world, 0 uses every core. PageSize::Huge keeps the
+    // balls and cells on huge pages, which pays off from around ten million balls, best with a reserve() up
+    // front so all of it is mapped and faulted in before the first step.
+    CollidingWorld(int cellSize, Vec2<int> worldConstraint, unsigned threadCount = 0,
+                   PageSize pageSize = PageSize::Normal);
+    CollidingWorld(int cellSize, Vec2<int> worldConstraint, WorldOptions const& options);
+
+    // the frame graph points back at the world, so it has to stay where it is
+    CollidingWorld(CollidingWorld const&) = delete;
+    CollidingWorld& operator=(CollidingWorld const&) = delete;
+    ~CollidingWorld();
+
+    // Steps the world on its own thread, stepsPerSecond times a second or as fast as it can with 0, so a slow
+    // step no longer holds up drawing. While it runs update() only hands the mouse over and picks up the
+    // latest snapshot, and the render loop should read the world through getSnapshot() instead of the other
+    // getters.
+    void startSimulation(int stepsPerSecond = 60);
+    void stopSimulation(void);
+    bool isSimulating(void) const;
+
+    // state picked up by the last update() on the render side, it stays valid until the next update()
+    WorldSnapshot const& getSnapshot(void) const;
+    // Calls fn(begin, end) for the runs of getSnapshot().sprites whose cells may show in view, a rectangle in
+    // world coordinates, a run per row of the grid from the top. The balls outside the grid are left to the
+    // caller, they start at the snapshot's last cellStart.
+    template <typename F>
+    void forEachSpriteRange(Rectangle view, F&& fn) const {
+        auto& cellStart = getSnapshot().cellStart;
+        if (cellStart.empty()) return;
+        // A ball pokes at most a cell out of its own, and collisions can have moved it a little since it was
+        // sorted into its cell, so two more cells on every side catch every ball that shows.
+        int topRow = std::max(0, (int)floorf(view.y / cellSize) - 2 - firstRow);
+        int bottomRow = std::min(gridSize.y - 1, (int)floorf((view.y + view.height) / cellSize) + 2 - firstRow);
+        int firstColumn = std::max(0, (int)floorf(view.x / cellSize) - 2);
+        int lastColumn = std::min(gridSize.x - 1, (int)floorf((view.x + view.width) / cellSize) + 2);
+        for (int row = topRow; row <= bottomRow && firstColumn <= lastColumn; row++) {
+            auto start = cellStart.data() + row * gridSize.x;
+            size_t begin = start[firstColumn], end = start[lastColumn + 1];
+            if (begin < end) fn(begin, end);
+        }
+    }
 
+    // These queue a command and return right away, they can be called from any thread. The commands are
+    // applied in the order they were queued at the start of the next step. When the queue is full the caller
+    // waits for a running step to finish and then applies what is queued itself. Ball ids cannot be negative,
+    // and adding a ball with an id that is in use replaces that ball. A world has room for 256 different
+    // combinations of radius, mass and colour at a time. Past that a ball takes on the closest one in use, so
+    // it can end up with another radius and mass than it was added with, which getSubstitutedCount() counts.
     void addBall(Ball ball);
     void removeBall(int id);
+    // Like calling addBall or removeBall for each of them, but queued as a single command that makes room for
+    // all the balls at once
+    void addBalls(std::span<Ball const> balls);
+    void removeBalls(std::span<int const> ids);
+    // removes every ball predicate returns true for, it is called on the thread that steps the world
+    void removeBalls(std::function<bool(Ball const&)> predicate);
+    // changes the ball's velocity by impulse / mass, a ball without mass is left as it is
+    void applyImpulse(int id, Vector2 impulse);
+    // moves the ball to pos, like dragging it with the mouse
+    void dragBall(int id, Vector2 pos);
 
     bool checkBallCollision(Vec2<int> cell, int id1, int id2);
     void resolveCollisions(Vec2<int> cell);
@@ -109,22 +466,89 @@ class CollidingWorld {
     bool isValidCell(Vec2<int> cell);
     void buildCells(void);
 
-    Ball* getSelected(void);
+    // the handle of the ball with this id as of the last step, or one that refers to nothing
+    BallHandle getHandle(int id) const;
+    // the ball a handle refers to or nullptr once it is gone, the pointer is only good until the next step
+    BallBody* getBall(BallHandle handle);
+    BallMaterial const& getMaterial(uint8_t material) const;
+    // position and velocity of a body, these work in the compact build too
+    Vector2 getPosition(BallBody const& body) const;
+    Vector2 getVelocity(BallBody const& body) const;
+    void setPosition(BallBody& body, Vector2 position) const;
+    void setVelocity(BallBody& body, Vector2 velocity) const;
+
+    BallBody* getSelected(void);
     void setSelected(Vector2 mousePos, BallSelectionType type);
     void unsetSelected(void);
     BallSelectionType getSelectionType(void) const;
 
+#ifndef BALLS_HEADLESS
     void update(Vector2 mouseCoords, bool checkCollision);
     void update(Vector2 mouseCoords);
+#endif
+    // steps by dt instead of the frame time, so the world can be run without a window
+    void update(Vector2 mouseCoords, bool checkCollision, float dt);
+
+    // What stepAsync returns. The step runs on the world's pool and the awaiting coroutine carries on on the
+    // pool thread that finished it, a world with a single thread steps right away without suspending.
+    class StepAwaiter {
+       public:
+        bool await_ready(void) const;
+        bool await_suspend(std::coroutine_handle<> caller);
+        void await_resume(void) const {}
+
+       private:
+        friend class CollidingWorld;
+        StepAwaiter(CollidingWorld& world, Vector2 mouseCoords, float dt, bool checkCollision);
+        static void run(void* ctx);
+
+        CollidingWorld& world;
+        Vector2 mouseCoords;
+        float dt;
+        bool checkCollision;
+        std::coroutine_handle<> caller;
+        ThreadPool::Posted work;
+    };
+
+    // co_await world.stepAsync(mouseCoords, dt) steps like update(mouseCoords, checkCollision, dt) without
+    // blocking the thread in the meantime, a selected ball follows mouseCoords as it would there. Only one step
+    // of a world may be in flight at a time, and not while it runs its own simulation thread.
+    StepAwaiter stepAsync(Vector2 mouseCoords, float dt, bool checkCollision = true);
     void toggleUpdate(void);
     bool isUpdating(void) const;
 
     std::vector<Vec2<int>> getRelatedCoords(Vec2<int> pos);
 
+    // Sizes every buffer of the world for up to maxBalls balls at once, and the collision scratch of every
+    // thread for a neighbourhood with expectedPairs colliding pairs. With hardCapacity a step never grows a
+    // buffer: new balls that would take the world past maxBalls are dropped and counted in getDroppedCount().
+    // Balls the world already holds past maxBalls are kept, and nothing new is added until enough of them are
+    // removed. Balls that replace one with the same id are never dropped.
+    // Only while the world is not being stepped.
+    void reserve(size_t maxBalls, size_t expectedPairs, bool hardCapacity = false);
+    size_t getDroppedCount(void) const;
+    // balls so far that took on the closest material instead of their own, see addBall
+    size_t getSubstitutedCount(void) const;
+    // what the world holds on to right now, only while it is not being stepped
+    WorldMemory memoryFootprint(void) const;
+
     int getLastBallId(void) const;
     int getBallCount(void) const;
+    // Ball number index as of the last step, from 0 to getBallCount() - 1 in no particular order. Only for the
+    // thread that steps the world. The world does not keep acc, it comes back as zero.
+    Ball getBallAt(size_t index) const;
+    unsigned getThreadCount(void) const;
+    int getCellSize(void) const;
+    // cells across and down, the snapshot's cellStart has one entry per cell and one more
+    Vec2<int> getGridSize(void) const;
+    // the world's cell row that is the grid's first row, see WorldOptions::gridRows
+    int getFirstRow(void) const;
+    Vec2<int> getWorldConstraint(void) const;
 
+#ifndef BALLS_HEADLESS
+    // draws getSnapshot()
     void draw(void);
+#endif
 };
 
 #endif  // BALLS_H
\ No newline at end of file
@@ -0,0 +1,76 @@
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+// Bounded lock-free queue that any number of threads push into and a single thread drains. Every slot
+// carries a sequence number that tells producers and the consumer whose turn it is, so a producer only
+// contends with other producers on one compare-and-swap. Memory is allocated once up front.
+template <typename T>
+class CommandQueue {
+   public:
+    // capacity is rounded up to a power of two
+    explicit CommandQueue(size_t capacity) : head(0), tail(0) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        mask = size - 1;
+        slots = std::make_unique<Slot[]>(size);
+        for (size_t i = 0; i < size; i++) slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    CommandQueue(CommandQueue const&) = delete;
+    CommandQueue& operator=(CommandQueue const&) = delete;
+
+    // bytes taken by the slots, not counting anything the items allocate themselves
+    size_t getMemory(void) const { return (mask + 1) * sizeof(Slot); }
+
+    // safe from any thread, false when the queue is full. An rvalue is only moved from when it was queued.
+    template <typename U>
+    bool push(U&& item) {
+        auto pos = tail.load(std::memory_order_relaxed);
+        while (true) {
+            auto& slot = slots[pos & mask];
+            auto seq = slot.sequence.load(std::memory_order_acquire);
+            auto diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    slot.item = std::forward<U>(item);
+                    slot.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // only called by the consuming thread, false when there is nothing ready
+    bool pop(T& item) {
+        auto& slot = slots[head & mask];
+        if ((intptr_t)slot.sequence.load(std::memory_order_acquire) - (intptr_t)(head + 1) < 0) return false;
+        item = std::move(slot.item);
+        slot.sequence.store(head + mask + 1, std::memory_order_release);
+        head++;
+        return true;
+    }
+
+   private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    std::unique_ptr<Slot[]> slots;
+    size_t mask;
+    // the consumer's position, only touched by the consuming thread
+    alignas(64) size_t head;
+    alignas(64) std::atomic<size_t> tail;
+};
+
+#endif  // COMMAND_QUEUE_H
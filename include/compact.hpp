@@ -0,0 +1,75 @@
+#ifndef COMPACT_H
+#define COMPACT_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+// Conversions for the compact build (BALLS_COMPACT), which stores velocities as half floats and positions as
+// a cell and a 16 bit fixed point offset inside it. They are inline so the world and the integrator's scalar
+// loop round exactly like the vector kernels, which do the same steps with F16C and AVX2.
+
+// steps of the fixed point offset across one cell
+constexpr float CELL_STEPS = 65536.0f;
+
+// rounds to the nearest half float, ties to even, like vcvtps2ph
+inline uint16_t toHalf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t abs = bits & 0x7fffffff;
+    if (abs > 0x7f800000) return sign | 0x7e00 | ((abs >> 13) & 0x3ff);
+    // 65520 and up round to infinity
+    if (abs >= 0x477ff000) return sign | 0x7c00;
+    if (abs >= 0x38800000) return sign | ((abs + 0xfff + ((abs >> 13) & 1) - 0x38000000) >> 13);
+    // below 2^-25 is closer to zero than to the smallest subnormal
+    if (abs < 0x33000000) return sign;
+    uint32_t mantissa = (abs & 0x7fffff) | 0x800000;
+    uint32_t shift = 126 - (abs >> 23);
+    uint32_t half = mantissa >> shift;
+    uint32_t rest = mantissa & ((1u << shift) - 1), middle = 1u << (shift - 1);
+    if (rest > middle || (rest == middle && (half & 1))) half++;
+    return sign | half;
+}
+
+inline float fromHalf(uint16_t half) {
+    uint32_t sign = (uint32_t)(half & 0x8000) << 16;
+    uint32_t exponent = (half >> 10) & 0x1f, mantissa = half & 0x3ff, bits;
+    if (exponent == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    } else if (exponent != 0) {
+        bits = sign | ((exponent + 112) << 23) | (mantissa << 13);
+    } else if (mantissa == 0) {
+        bits = sign;
+    } else {
+        // subnormal, shift it up until it has the implicit bit of a normal float
+        exponent = 113;
+        while (!(mantissa & 0x400)) {
+            mantissa <<= 1;
+            exponent--;
+        }
+        bits = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+    }
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// coordinate of a cell and an offset into it along one axis
+inline float unpackAxis(uint16_t cell, uint16_t offset, int cellSize) {
+    return (float)cell * (float)cellSize + (float)offset * ((float)cellSize / CELL_STEPS);
+}
+
+// The other way round for a grid of `cells` cells, positions outside of it end up on its edge. Rounding to the
+// nearest step can land on the next cell, that step is clamped to the last one of this cell instead.
+inline void packAxis(float position, int cellSize, int cells, uint16_t& cell, uint16_t& offset) {
+    float size = (float)cellSize;
+    position = std::fmax(0.0f, std::fmin(position, (float)cells * size));
+    int c = std::min((int)(position / size), cells - 1);
+    long steps = std::lrint((position - (float)c * size) * (CELL_STEPS / size));
+    cell = c;
+    offset = std::max(0L, std::min(steps, 65535L));
+}
+
+#endif  // COMPACT_H
\ No newline at end of file
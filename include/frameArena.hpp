@@ -0,0 +1,72 @@
+#ifndef FRAME_ARENA_H
+#define FRAME_ARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <memory_resource>
+#include <vector>
+
+// Scratch memory for a single step, handed out by bumping a pointer and all given back at once by reset().
+// There is one slot per thread so threads never share a bump pointer. A slot that runs out takes the rest from
+// the heap for that step and has its buffer grown at the next reset, so once a world has settled a step does
+// not allocate at all.
+class FrameArena {
+   public:
+    class Slot : public std::pmr::memory_resource {
+       public:
+        Slot(void);
+
+       private:
+        friend class FrameArena;
+        std::unique_ptr<std::byte[]> buffer;
+        size_t capacity;
+        size_t used;
+        // bytes asked for this step whether they fit or not, the buffer grows to this at reset
+        size_t wanted;
+        std::vector<std::unique_ptr<std::byte[]>> overflow;
+
+        void* do_allocate(size_t bytes, size_t alignment) override;
+        // memory only comes back through reset and Scope
+        void do_deallocate(void*, size_t, size_t) override {}
+        bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override;
+    };
+
+    // gives back everything allocated from a slot while it exists
+    class Scope {
+       public:
+        Scope(FrameArena& arena, unsigned slot);
+        ~Scope();
+
+        Scope(Scope const&) = delete;
+        Scope& operator=(Scope const&) = delete;
+
+        Slot* get(void) const;
+
+       private:
+        Slot& slot;
+        size_t used;
+    };
+
+    explicit FrameArena(unsigned slotCount);
+
+    FrameArena(FrameArena const&) = delete;
+    FrameArena& operator=(FrameArena const&) = delete;
+
+    Slot* get(unsigned slot);
+    size_t getCapacity(unsigned slot) const;
+
+    // gives back every allocation, no slot may be in use
+    void reset(void);
+    // grows the buffer of a slot to at least bytes so it does not have to grow later, no slot may be in use
+    void reserve(unsigned slot, size_t bytes);
+
+   private:
+    // kept apart so threads bumping neighbouring slots do not share a cache line
+    struct alignas(64) Padded {
+        Slot slot;
+    };
+    std::unique_ptr<Padded[]> slots;
+    unsigned slotCount;
+};
+
+#endif  // FRAME_ARENA_H
\ No newline at end of file
@@ -0,0 +1,42 @@
+#ifndef ID_MAP_H
+#define ID_MAP_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Finds the slot of a ball id. Ids can be anything from 0 to INT_MAX and are not reused in any order, so
+// this is an open-addressed hash table sized to the ids in it rather than an array indexed by id. Entries
+// live inline and are probed linearly, and erasing shifts the entries after it back, so a table that has
+// seen a lot of churn is no slower than a fresh one.
+class IdMap {
+   public:
+    // what get() returns for an id that is not in the map
+    static constexpr uint32_t NONE = UINT32_MAX;
+
+    uint32_t get(int id) const;
+    // adds id or changes its slot
+    void set(int id, uint32_t slot);
+    void erase(int id);
+    // makes room for count ids, the table neither grows before it holds that many nor shrinks below it again
+    void reserve(size_t count);
+
+    size_t size(void) const;
+    size_t getMemory(void) const;
+
+   private:
+    struct Entry {
+        // -1 while the entry is free
+        int id;
+        uint32_t slot;
+    };
+    std::vector<Entry> entries;
+    size_t count = 0;
+    // smallest capacity reserve() asked for
+    size_t reserved = 0;
+
+    size_t home(int id) const;
+    void rehash(size_t capacity);
+};
+
+#endif  // ID_MAP_H
\ No newline at end of file
@@ -0,0 +1,25 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include <cstddef>
+
+#include "balls.hpp"
+
+// fraction of the velocity that is removed every step, see Ball::update
+constexpr float BALL_DRAG = -0.01f;
+
+// Integrates `count` balls by `dt` and reflects them off the walls of `worldConstraint` in a single pass.
+// `radii` holds the radius of every material and has room for all 256 of them. The ball at `skipIndex`
+// (relative to `balls`, -1 for none) is left untouched so it can be dragged around. Balls with
+// `shouldUpdate` unset are not integrated but are still kept inside the walls.
+//
+// The work is done 16 or 8 balls at a time with AVX-512 or AVX2 when the cpu supports it, and the
+// remainder falls back to a scalar loop. The build turns off fp contraction so that both paths give
+// bit-identical results no matter where a ball lands in the array.
+//
+// `cellSize` is only used by the compact build, where positions are relative to the cell of the world's grid
+// they are in and a ball that moves is handed to its new cell here. It has an AVX2 and F16C kernel only.
+void integrateBalls(BallBody *balls, size_t count, float const *radii, float dt, Vec2<int> worldConstraint,
+                    int cellSize, long skipIndex);
+
+#endif  // INTEGRATOR_H
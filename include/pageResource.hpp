@@ -0,0 +1,37 @@
+#ifndef PAGE_RESOURCE_H
+#define PAGE_RESOURCE_H
+
+#include <cstddef>
+#include <memory_resource>
+
+// pages the big arrays of a world are kept on
+enum class PageSize {
+    // whatever new gives out
+    Normal,
+    // huge pages where the system has them, so walking millions of balls does not keep missing the TLB
+    Huge,
+};
+
+// Memory for the arrays that grow with the ball count. With huge pages every allocation that is big enough
+// gets its own mapping, from the reserved huge pages if there are any and otherwise as normal pages the
+// kernel is asked to back with transparent huge pages. Mappings are touched right away so their page faults
+// happen when the array grows instead of in the first steps that use it. Small allocations and systems
+// without mmap just use new.
+class PageResource : public std::pmr::memory_resource {
+   public:
+    explicit PageResource(PageSize pageSize);
+
+    PageResource(PageResource const&) = delete;
+    PageResource& operator=(PageResource const&) = delete;
+
+    PageSize getPageSize(void) const;
+
+   private:
+    PageSize pageSize;
+
+    void* do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void* pointer, size_t bytes, size_t alignment) override;
+    bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override;
+};
+
+#endif  // PAGE_RESOURCE_H
\ No newline at end of file
@@ -0,0 +1,45 @@
+#ifndef PERF_OVERLAY_H
+#define PERF_OVERLAY_H
+
+#include <cstdint>
+
+#include "balls.hpp"
+#include "ringBuffer.hpp"
+
+// allocations made through operator new since the program started, on any thread
+uint64_t getAllocationCount(void);
+
+// Frame times and counters of the last few seconds, drawn over the window. Every frame adds a point to a
+// rolling graph per phase, the world's three step phases and drawing and presenting the frame, so the phase
+// that blows up when balls are added stands out. Everything is kept in fixed ring buffers and the text is
+// formatted into raylib's own buffer, so recording and drawing a frame allocate nothing.
+class PerfOverlay {
+   public:
+    enum Phase { Integrate, BuildCells, Collide, Draw, Present, PHASES };
+
+    // adds a frame: the stats of the step in snapshot, and the seconds the previous frame took to draw and to
+    // present, vsync included
+    void record(WorldSnapshot const& snapshot, float drawSeconds, float presentSeconds);
+    // draws the fps and the ball count, and when expanded the counters and graphs under them, from x, y down
+    void draw(int x, int y) const;
+
+    void setExpanded(bool expanded);
+    bool isExpanded(void) const;
+
+   private:
+    // four seconds at 60 fps
+    static constexpr size_t HISTORY = 240;
+
+    RingBuffer<float, HISTORY> phases[PHASES];
+    RingBuffer<uint64_t, HISTORY> pairsTested;
+    RingBuffer<uint64_t, HISTORY> contacts;
+    // allocations made during each frame
+    RingBuffer<uint64_t, HISTORY> allocations;
+    RingBuffer<size_t, HISTORY> memory;
+    uint64_t allocationsBefore = 0;
+    int ballCount = 0;
+    bool updating = true;
+    bool expanded = true;
+};
+
+#endif  // PERF_OVERLAY_H
\ No newline at end of file
@@ -0,0 +1,39 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <cstddef>
+
+// The last N values pushed, oldest first. The values live in the object itself, so pushing never allocates
+// and just writes over the oldest value once the buffer is full.
+template <typename T, size_t N>
+class RingBuffer {
+   public:
+    void push(T value) {
+        values[next] = value;
+        next = (next + 1) % N;
+        if (count < N) count++;
+    }
+
+    // how many values are held, at most N
+    size_t size(void) const { return count; }
+    static constexpr size_t capacity(void) { return N; }
+
+    // the i-th oldest value held
+    T const& operator[](size_t i) const { return values[(next + N - count + i) % N]; }
+    // the value pushed last, only when there is one
+    T const& back(void) const { return values[(next + N - 1) % N]; }
+
+    // largest value held, T() when empty
+    T max(void) const {
+        T most = T();
+        for (size_t i = 0; i < count; i++) most = values[i] > most ? values[i] : most;
+        return most;
+    }
+
+   private:
+    T values[N] = {};
+    size_t next = 0;
+    size_t count = 0;
+};
+
+#endif  // RING_BUFFER_H
\ No newline at end of file
@@ -0,0 +1,61 @@
+#ifndef SOFTWARE_RENDERER_H
+#define SOFTWARE_RENDERER_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "balls.hpp"
+#include "threadPool.hpp"
+
+// Draws what CollidingWorld::draw shows into an RGB image in memory, for machines with neither a gpu nor a
+// display. The image is cut into tiles that the pool draws in parallel. A tile only goes through the cells
+// it overlaps, in the order draw() goes through the balls, so overlapping balls come out the same. Circles
+// are anti-aliased by how much of every pixel they cover, worked out 8 pixels at a time with AVX2.
+class SoftwareRenderer {
+   public:
+    // threadCount counts the calling thread as well, 0 uses every core
+    SoftwareRenderer(int width, int height, unsigned threadCount = 0);
+
+    SoftwareRenderer(SoftwareRenderer const&) = delete;
+    SoftwareRenderer& operator=(SoftwareRenderer const&) = delete;
+
+    // draws the whole world, as big as it fits
+    void draw(CollidingWorld const& world);
+    // draws what is in view, a rectangle in world coordinates that is centred in the image and scaled to fit
+    // it without changing its shape
+    void draw(CollidingWorld const& world, Rectangle view);
+
+    void setGridVisible(bool visible);
+    bool isGridVisible(void) const;
+
+    int getWidth(void) const;
+    int getHeight(void) const;
+    // red, green and blue bytes of every pixel, row by row from the top left, as of the last draw()
+    uint8_t const* getPixels(void) const;
+
+    // binary PPM, which just about every image tool and ffmpeg read
+    void writePpm(std::ostream& out) const;
+    // writePpm to a file, throws std::runtime_error when it cannot be written
+    void savePpm(std::string const& path) const;
+    // only the pixels, for piping into something like ffmpeg -f rawvideo -pixel_format rgb24
+    void writeRaw(std::ostream& out) const;
+
+   private:
+    int width;
+    int height;
+    bool gridVisible;
+    ThreadPool pool;
+    std::vector<uint8_t> pixels;
+    // a tile's red, green and blue planes in floats for every pool slot, so a tile is blended in the cache
+    std::vector<float> tiles;
+
+    // the point of the world at the image's top left and how many pixels a unit of the world takes
+    Vector2 origin;
+    float scale;
+
+    void drawTile(CollidingWorld const& world, size_t tile, float* planes);
+};
+
+#endif  // SOFTWARE_RENDERER_H
\ No newline at end of file
@@ -0,0 +1,60 @@
+#ifndef STRIP_DOMAIN_H
+#define STRIP_DOMAIN_H
+
+#include <unordered_set>
+#include <vector>
+
+#include "balls.hpp"
+#include "transport.hpp"
+
+// One horizontal strip of a world that is split across processes, every rank of the transport steps the
+// strip with its own cell rows. The strip's world has the whole world's size and walls, but its grid only
+// has those rows and a halo row on either side, so a rank's step costs about its share of the world. A ball
+// can move out of the strip during a step like anywhere else. Before each step the strips hand over the
+// balls that left them to the neighbour on that side, and send copies of the balls within one cellSize of
+// their edges to the neighbour. Those ghost copies are not integrated, they are only there so balls at the
+// edge collide with the other side, and are thrown away again at the next step. As the ghosts keep where
+// they were before the step, balls along a strip edge end up close to, but not exactly where, a single world
+// would put them.
+class StripDomain {
+   public:
+    // every rank has to be constructed with the same cellSize and worldConstraint
+    StripDomain(Transport& transport, int cellSize, Vec2<int> worldConstraint, unsigned threadCount = 0);
+
+    StripDomain(StripDomain const&) = delete;
+    StripDomain& operator=(StripDomain const&) = delete;
+
+    // adds the ball if it is in this strip, so every rank can run the same setup code
+    void addBall(Ball const& ball);
+    bool owns(Vector2 pos) const;
+
+    // steps this strip by dt, every rank has to call it the same number of times
+    void step(float dt, bool checkCollision = true);
+
+    // the world of this strip, it holds the ghosts of the last step as well
+    CollidingWorld& getWorld(void);
+    int getOwnedCount(void) const;
+    // first and one past the last y of this strip
+    float getTop(void) const;
+    float getBottom(void) const;
+
+   private:
+    Transport& transport;
+    int cellSize;
+    int rank;
+    int size;
+    float top;
+    float bottom;
+    CollidingWorld world;
+    std::unordered_set<int> ghosts;
+    // owned balls as of the last step, and the ones added since that the world only takes in at the next
+    int owned;
+    int added;
+
+    std::vector<Transport::Exchange> exchanges;
+
+    // sends up and down to the strips above and below and returns what they sent back
+    std::vector<Ball> swap(std::vector<Ball> const& up, std::vector<Ball> const& down);
+};
+
+#endif  // STRIP_DOMAIN_H
\ No newline at end of file
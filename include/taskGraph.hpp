@@ -0,0 +1,63 @@
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include "threadPool.hpp"
+
+// Dependency graph of small tasks that runs on a ThreadPool. The graph is built once and can then be run any
+// number of times without allocating: a node is queued on the pool the moment its last dependency finishes,
+// so independent parts of the graph overlap instead of waiting on each other at phase boundaries.
+class TaskGraph {
+   public:
+    using Node = size_t;
+
+    TaskGraph(void);
+
+    TaskGraph(TaskGraph const &) = delete;
+    TaskGraph &operator=(TaskGraph const &) = delete;
+
+    // adds a node that runs fn once every node in dependencies has finished
+    template <typename F>
+    Node add(F &&fn, std::initializer_list<Node> dependencies = {}) {
+        nodes.push_back({std::function<void(void)>(std::forward<F>(fn)), {}, 0});
+        Node node = nodes.size() - 1;
+        for (auto dependency : dependencies) depend(node, dependency);
+        return node;
+    }
+
+    // makes node wait for `on` to finish
+    void depend(Node node, Node on);
+
+    size_t getNodeCount(void) const;
+
+    // allocates what run() needs after nodes were added, so not even the first run allocates
+    void prepare(void);
+
+    // runs every node once and returns when they are all done, the calling thread works on nodes too
+    void run(ThreadPool &pool);
+
+   private:
+    struct NodeData {
+        std::function<void(void)> fn;
+        std::vector<Node> successors;
+        unsigned dependencies;
+    };
+
+    std::vector<NodeData> nodes;
+    // dependencies left per node while the graph runs, only reallocated when nodes were added
+    std::unique_ptr<std::atomic<unsigned>[]> pending;
+    size_t pendingSize;
+
+    ThreadPool *pool;
+    ThreadPool::Job *job;
+
+    static void runNodes(void *ctx, size_t begin, size_t end);
+};
+
+#endif  // TASK_GRAPH_H
@@ -0,0 +1,148 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Persistent work-stealing pool. The threads are started once and sleep between jobs, so handing out
+// work every frame only costs a wake up.
+//
+// Every thread owns a deque of tasks. A task covers a range of items, and whoever runs it keeps splitting
+// it in half, pushing the upper half onto its own deque, until it is down to `grain` items. Idle threads
+// steal the oldest (and so largest) ranges from the other deques, which keeps every core busy even when
+// the cost per item is very uneven.
+class ThreadPool {
+   public:
+    // threadCount counts the calling thread as well, 0 picks one thread per hardware core
+    explicit ThreadPool(unsigned threadCount = 0);
+    ~ThreadPool();
+
+    ThreadPool(ThreadPool const &) = delete;
+    ThreadPool &operator=(ThreadPool const &) = delete;
+
+    unsigned getThreadCount(void) const;
+    // deque slot of the calling thread while it works for this pool, from 0 to getThreadCount() - 1, and
+    // getThreadCount() for any other thread
+    unsigned getCurrentSlot(void) const;
+
+    // Calls fn(begin, end) for chunks of at most `grain` items covering [0, count) and returns once all of
+    // them are done. The calling thread works on chunks too, and fn may itself call parallelFor.
+    template <typename F>
+    void parallelFor(size_t count, size_t grain, F &&fn) {
+        using Fn = std::remove_reference_t<F>;
+        run(count, grain, [](void *ctx, size_t begin, size_t end) { (*static_cast<Fn *>(ctx))(begin, end); },
+            (void *)&fn);
+    }
+
+   private:
+    // the graph hands out single nodes as they become ready instead of splitting a range
+    friend class TaskGraph;
+
+    using ChunkFn = void (*)(void *, size_t, size_t);
+
+    struct Job {
+        ChunkFn fn;
+        void *ctx;
+        size_t grain;
+        // items that have not been run yet, the job is done once this hits 0
+        std::atomic<size_t> remaining;
+        // nobody waits for a posted job, it may be gone as soon as fn returns
+        bool posted;
+        // job whose task started this one, nullptr for a posted job or one started outside of the pool
+        Job *parent;
+    };
+
+    struct Task {
+        Job *job;
+        size_t begin;
+        size_t end;
+    };
+
+    // fixed size so pushing never allocates, a full deque just stops splitting
+    class Deque {
+       public:
+        bool push(Task task);
+        // with a group, only takes the task if it belongs to that group, see inGroup
+        bool pop(Task &task, Job const *group = nullptr);
+        bool steal(Task &task, Job const *group = nullptr);
+
+       private:
+        static constexpr size_t CAPACITY = 1024;
+        std::mutex mutex;
+        Task tasks[CAPACITY];
+        size_t head = 0;
+        size_t tail = 0;
+    };
+
+    const unsigned threadCount;
+    // slot 0 belongs to whichever outside thread is calling parallelFor, the rest to the workers
+    std::unique_ptr<Deque[]> deques;
+    std::vector<std::thread> workers;
+    std::mutex callerMutex;
+
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    std::atomic<long> queued;
+    std::atomic<unsigned> sleeping;
+    bool stopping;
+    // posted work waiting for a worker, it does not belong to any thread
+    Deque inbox;
+
+    // binds the calling thread to a deque for as long as it is inside a job, outside threads share slot 0
+    // one at a time
+    class Caller {
+       public:
+        explicit Caller(ThreadPool &pool);
+        ~Caller();
+
+       private:
+        ThreadPool const *previousPool;
+        unsigned previousSlot;
+        Job *previousJob;
+        std::unique_lock<std::mutex> lock;
+    };
+
+    void run(size_t count, size_t grain, ChunkFn fn, void *ctx);
+    // queues item on the current thread's deque, which has to belong to a Caller or a worker
+    void spawn(Job *job, size_t item);
+    // runs tasks of job's group until every item of job is finished
+    void wait(Job &job);
+    // counts a freshly pushed task and wakes a sleeping worker for it
+    void signal(void);
+    // A task to run next, only from job's group if one is given. Posted work is left to the workers, as it could
+    // otherwise end up running inside whatever the caller of wait was in the middle of.
+    bool findTask(unsigned slot, Task &task, Job const *group);
+    // the job of the task the calling thread is running, the parent of any job it starts
+    Job *runningJob(void) const;
+    // whether job is group or was started, at any depth, by a task of group
+    static bool inGroup(Job const *job, Job const *group);
+    void execute(unsigned slot, Task task);
+    void workerLoop(unsigned slot);
+    static void runPosted(void *ctx, size_t begin, size_t end);
+
+   public:
+    // Work handed to post(), it has to stay alive until fn is called and is free to go once fn runs
+    class Posted {
+       public:
+        Posted(void (*fn)(void *), void *ctx);
+
+       private:
+        friend class ThreadPool;
+        void (*fn)(void *);
+        void *ctx;
+        Job job;
+    };
+
+    // Calls work's fn on one of the workers and returns right away, from any thread. A pool with only the
+    // calling thread has no one to hand it to, so there it is called before post returns.
+    void post(Posted &work);
+};
+
+#endif  // THREAD_POOL_H
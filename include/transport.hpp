@@ -0,0 +1,55 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <memory>
+#include <vector>
+
+// Moves byte messages between the processes that share a simulation. Every process has a rank from 0 to
+// getSize() - 1, and all of them take part in the same exchanges in the same order.
+class Transport {
+   public:
+    // one message each way between this process and peer
+    struct Exchange {
+        int peer;
+        std::vector<char> out;
+        std::vector<char> in;
+    };
+
+    virtual ~Transport() = default;
+
+    virtual int getRank(void) const = 0;
+    virtual int getSize(void) const = 0;
+
+    // sends every out and fills in every in, all at once so neighbours waiting on each other cannot deadlock
+    virtual void exchange(std::vector<Exchange>& exchanges) = 0;
+};
+
+#ifndef _WIN32
+// Transport between processes on the same machine over Unix domain sockets, one socket pair per two ranks
+class SocketTransport : public Transport {
+   public:
+    // Forks into processCount processes connected to each other and returns the transport of the calling
+    // one, rank 0 is the original process. Call this before starting any threads, including the pools of
+    // worlds. Rank 0 waits for the others when its transport is destroyed.
+    static std::unique_ptr<SocketTransport> forkLocal(int processCount);
+
+    SocketTransport(SocketTransport const&) = delete;
+    SocketTransport& operator=(SocketTransport const&) = delete;
+    ~SocketTransport();
+
+    int getRank(void) const override;
+    int getSize(void) const override;
+    void exchange(std::vector<Exchange>& exchanges) override;
+
+   private:
+    SocketTransport(int rank, std::vector<int> sockets, std::vector<int> children);
+
+    int rank;
+    // socket to every other rank, -1 for this one
+    std::vector<int> sockets;
+    // processes forked by rank 0
+    std::vector<int> children;
+};
+#endif
+
+#endif  // TRANSPORT_H
\ No newline at end of file
@@ -0,0 +1,56 @@
+#ifndef TRIPLE_BUFFER_H
+#define TRIPLE_BUFFER_H
+
+#include <atomic>
+#include <cstdint>
+
+// Lock-free hand over of the latest value from one writer thread to one reader thread. The writer fills in
+// back() and publishes it, the reader picks up whatever was published last. Neither side ever waits, the
+// reader just skips values that were replaced before it got to them.
+template <typename T>
+class TripleBuffer {
+   public:
+    TripleBuffer(void) = default;
+    // builds every slot as T(args...)
+    template <typename... Args>
+    explicit TripleBuffer(Args const&... args) : slots{T(args...), T(args...), T(args...)} {}
+
+    // the slot the writer fills in, only touched by the writing thread
+    T& back(void) { return slots[backIndex]; }
+
+    // hands the back slot to the reader and continues with the spare one
+    void publish(void) { backIndex = middle.exchange(backIndex | DIRTY, std::memory_order_acq_rel) & INDEX; }
+
+    // moves the reader on to the latest published slot, only called by the reading thread
+    T const& read(void) {
+        if (middle.load(std::memory_order_relaxed) & DIRTY) {
+            frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+        }
+        return slots[frontIndex];
+    }
+
+    // the slot the reader picked up last, it stays untouched until the next read()
+    T const& front(void) const { return slots[frontIndex]; }
+
+    // calls fn on all three slots, only while neither side is using the buffer
+    template <typename F>
+    void forEachSlot(F&& fn) {
+        for (auto& slot : slots) fn(slot);
+    }
+    template <typename F>
+    void forEachSlot(F&& fn) const {
+        for (auto& slot : slots) fn(slot);
+    }
+
+   private:
+    static constexpr uint8_t INDEX = 3;
+    static constexpr uint8_t DIRTY = 4;
+
+    T slots[3] = {};
+    uint8_t backIndex = 0;
+    // index of the slot in between, with DIRTY set while it holds a value the reader has not seen
+    std::atomic<uint8_t> middle = 1;
+    uint8_t frontIndex = 2;
+};
+
+#endif  // TRIPLE_BUFFER_H
@@ -0,0 +1,40 @@
+#ifndef WORLD_BATCH_H
+#define WORLD_BATCH_H
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "balls.hpp"
+#include "threadPool.hpp"
+
+// Many independent worlds stepped together on one pool, for sweeps over lots of small worlds. The worlds
+// step on the batch's pool, which spreads them over the threads biggest first so a large one does not end up
+// last on its own, and a big world's step still splits over idle threads. The worlds publish no snapshots,
+// read them through the getters after step().
+class WorldBatch {
+   public:
+    // threadCount counts the calling thread as well, 0 uses every core
+    explicit WorldBatch(unsigned threadCount = 0);
+
+    WorldBatch(WorldBatch const&) = delete;
+    WorldBatch& operator=(WorldBatch const&) = delete;
+
+    // adds a world that is stepped along with the others, it lives as long as the batch
+    CollidingWorld& addWorld(int cellSize, Vec2<int> worldConstraint);
+    CollidingWorld& getWorld(size_t index);
+    size_t getWorldCount(void) const;
+    unsigned getThreadCount(void) const;
+
+    // steps every world by dt and returns once they are all done, balls are added and removed through the
+    // worlds as usual
+    void step(float dt, bool checkCollision = true);
+
+   private:
+    ThreadPool pool;
+    std::vector<std::unique_ptr<CollidingWorld>> worlds;
+    // indices of the worlds from the most balls to the least, as of the last step
+    std::vector<size_t> order;
+};
+
+#endif  // WORLD_BATCH_H
\ No newline at end of file
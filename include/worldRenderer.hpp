@@ -0,0 +1,56 @@
+#ifndef WORLD_RENDERER_H
+#define WORLD_RENDERER_H
+
+#include <vector>
+
+#include "balls.hpp"
+
+// Draws worlds with textured quads instead of tessellated circles. Every ball is the same white circle
+// texture scaled to its radius and tinted with its colour, and raylib batches quads that share a texture,
+// so a frame costs a few draw calls however many balls there are. Works on any GL raylib runs on, software
+// ones included. It holds GPU resources: create it after InitWindow and let it go before CloseWindow.
+//
+// Zoomed out it draws less: balls that would be under a pixel become single pixels, and once the cells get
+// that small it stops looking at balls at all and shows how crowded every cell is as a heatmap.
+class WorldRenderer {
+   public:
+    WorldRenderer(void);
+    ~WorldRenderer();
+
+    WorldRenderer(WorldRenderer const&) = delete;
+    WorldRenderer& operator=(WorldRenderer const&) = delete;
+
+    // draws the grid and the balls of world.getSnapshot()
+    void draw(CollidingWorld const& world);
+    // Only draws what can be seen of them in view, a rectangle in world coordinates. The grid tells which
+    // balls those are, so the cost follows what is on screen rather than the size of the world. zoom is how
+    // many pixels a unit of the world takes on screen and decides how much detail is worth drawing.
+    void draw(CollidingWorld const& world, Rectangle view, float zoom = 1);
+
+    // The grid is drawn once into a texture that every frame just copies, or every frame for worlds over
+    // 4096 on a side. It is redrawn by itself when the world's cell size or size differs from last time,
+    // invalidateGrid() forces that for anything else.
+    void invalidateGrid(void);
+    void setGridVisible(bool visible);
+    bool isGridVisible(void) const;
+
+   private:
+    Texture2D circle;
+    RenderTexture2D grid;
+    // a texel per block of cells in view, grown when a view needs more of them
+    Texture2D heatmap;
+    std::vector<uint32_t> heatCounts;
+    std::vector<Color> heatPixels;
+    // colour of every heat level, from empty to the most crowded block in view
+    Color palette[256];
+    // what grid was drawn for, a cell size of 0 when it has to be drawn again
+    int gridCellSize;
+    Vec2<int> gridSize;
+    bool gridVisible;
+
+    void drawGrid(CollidingWorld const& world, Rectangle view);
+    void drawHeatmap(CollidingWorld const& world, Rectangle view, float zoom);
+    void drawBall(BallSprite const& sprite, float zoom);
+};
+
+#endif  // WORLD_RENDERER_H
\ No newline at end of file
@@ -5,15 +5,19 @@
 Ball::Ball(int i, int r, float m, Color c, Vector2 p, Vector2 v, Vector2 a)
     : id(i), radius(r), mass(m), color(c), pos(p), vel(v), acc(a), shouldUpdate(true) {}
 
-void Ball::update(void) {
+void Ball::update(float dt) {
     if (shouldUpdate) {
         this->acc = Vector2Scale(this->vel, -0.01);
         this->vel = Vector2Add(this->vel, this->acc);
-        this->pos = Vector2Add(this->pos, Vector2Scale(this->vel, GetFrameTime()));
+        this->pos = Vector2Add(this->pos, Vector2Scale(this->vel, dt));
     }
 }
 
+#ifndef BALLS_HEADLESS
+void Ball::update(void) { update(GetFrameTime()); }
+
 void Ball::draw(void) { DrawCircle(pos.x, pos.y, radius, color); }
+#endif
 
 void Ball::toggleUpdate(void) { this->shouldUpdate = !shouldUpdate; }
 
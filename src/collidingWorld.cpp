@@ -1,91 +1,342 @@
 #include <math.h>
 
 #include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <string>
+#include <tuple>
 #include <unordered_set>
 
 #include "balls.hpp"
+#include "compact.hpp"
+#include "integrator.hpp"
 
-CollidingWorld::CollidingWorld(int c, Vec2<int> constr)
-    : cellSize(c), selectedBall(-1), shouldUpdate(true), lastId(-1), shooter(nullptr) {
+// longest step the simulation thread takes, so a stall does not throw balls through each other
+constexpr float MAX_STEP = 0.1f;
+
+// integration chunks per thread, more than one so a thread that finishes early can steal
+constexpr unsigned INTEGRATE_CHUNKS_PER_THREAD = 4;
+// cells of a row resolved per task, small because a single crowded cell can cost as much as thousands of
+// empty ones
+constexpr size_t COLLIDE_GRAIN = 4;
+// balls per task in the passes of buildCells that go over every ball
+constexpr size_t BUILD_GRAIN = 4096;
+// blocks of cells per thread in the prefix sum of buildCells
+constexpr unsigned PREFIX_BLOCKS_PER_THREAD = 4;
+// cell of a ball that is outside the grid, it is left out of the cells
+constexpr uint32_t NO_CELL = UINT32_MAX;
+// how far eraseBall walks down from the last id before it looks through every ball instead
+constexpr int LAST_ID_SCAN = 64;
+
+CollidingWorld::CollidingWorld(int c, Vec2<int> constr, unsigned threadCount, PageSize pageSize)
+    : CollidingWorld(c, constr, WorldOptions{.threadCount = threadCount, .pageSize = pageSize}) {}
+
+CollidingWorld::CollidingWorld(int c, Vec2<int> constr, WorldOptions const &options)
+    : pages(options.pageSize),
+      capacity(0),
+      hardCapacity(false),
+      dropped(0),
+      substituted(0),
+      selectionType(BallSelectionType::Drag),
+      cellSize(c),
+      shouldUpdate(true),
+      lastId(-1),
+      ownPool(options.pool == nullptr ? std::make_unique<ThreadPool>(options.threadCount) : nullptr),
+      pool(options.pool == nullptr ? ownPool.get() : options.pool),
+      publishing(options.publishSnapshots),
+      arena(pool->getThreadCount() + 1),
+      frameMouse{0, 0},
+      frameDt(0),
+      frameCollide(false),
+      snapshots(&pages),
+      commands(options.commandCapacity),
+      simulating(false) {
     worldConstraint = constr;
     auto [wx, wy] = worldConstraint;
-    for (int i = 0; i < wx / cellSize; i++) {
-        for (int j = 0; j < wy / cellSize; j++) {
-            auto pos = Vec2<int>{i, j};
-            cells[pos] = {};
+    int rows = wy / cellSize + 1;
+    firstRow = std::clamp(options.firstRow, 0, rows - 1);
+    gridSize = {wx / cellSize + 1, rows - firstRow};
+    if (options.gridRows > 0) gridSize.y = std::min(gridSize.y, options.gridRows);
+    size_t cellCount = gridSize.x * gridSize.y;
+    cellStart.resize(cellCount + 1);
+    cellCounts.resize(cellCount);
+    blockStart.resize(pool->getThreadCount() * PREFIX_BLOCKS_PER_THREAD);
+    collisionCounters.resize(pool->getThreadCount() + 1);
+    materials.reserve(256);
+    materialUses.reserve(256);
+    if (publishing) {
+        snapshots.forEachSlot([cellCount](WorldSnapshot &snapshot) { snapshot.cellStart.resize(cellCount + 1); });
+    }
+    buildFrameGraph();
+}
+
+CollidingWorld::~CollidingWorld() { stopSimulation(); }
+
+void CollidingWorld::buildFrameGraph(void) {
+    auto input = frame.add([this]() { applyInput(); });
+
+    auto build = frame.add([this]() {
+        buildStart = std::chrono::steady_clock::now();
+        buildCells();
+        if (publishing) {
+            auto &snapshot = snapshots.back();
+            snapshot.sprites.resize(balls.size());
+            std::copy(cellStart.begin(), cellStart.end(), snapshot.cellStart.begin());
         }
+        buildEnd = std::chrono::steady_clock::now();
+    });
+
+    size_t chunks = pool->getThreadCount() * INTEGRATE_CHUNKS_PER_THREAD;
+    for (size_t chunk = 0; chunk < chunks; chunk++) {
+        auto integrate = frame.add([this, chunk, chunks]() { integrateChunk(chunk, chunks); }, {input});
+        frame.depend(build, integrate);
     }
+
+    // Resolving a cell moves balls anywhere in its 3x3 neighbourhood, so two rows conflict when they are less
+    // than 3 apart. Rows are colored by row % 3 and a row waits only for the conflicting rows of earlier
+    // colors instead of for the whole previous color.
+    std::vector<TaskGraph::Node> collide(gridSize.y);
+    for (int color = 0; color < 3; color++) {
+        for (int row = color; row < gridSize.y; row += 3) {
+            collide[row] = frame.add([this, row]() { collideRow(row); }, {build});
+            for (int other = std::max(0, row - 2); other <= std::min(gridSize.y - 1, row + 2); other++) {
+                if (other % 3 < color) frame.depend(collide[row], collide[other]);
+            }
+        }
+    }
+
+    // a row's balls are final once the rows around it are resolved, the rest of the grid may still be busy
+    for (int row = 0; publishing && row < gridSize.y; row++) {
+        auto prepare = frame.add([this, row]() { prepareRow(row); });
+        for (int other = std::max(0, row - 1); other <= std::min(gridSize.y - 1, row + 1); other++) {
+            frame.depend(prepare, collide[other]);
+        }
+    }
+    frame.prepare();
+}
+
+void CollidingWorld::reserve(size_t maxBalls, size_t expectedPairs, bool hard) {
+    balls.reserve(maxBalls);
+    ballIds.reserve(maxBalls);
+    ballSlots.reserve(maxBalls);
+    slots.reserve(maxBalls);
+    freeSlots.reserve(maxBalls);
+    idSlots.reserve(maxBalls);
+    cellBalls.reserve(maxBalls);
+    ballCells.reserve(maxBalls);
+    if (publishing) {
+        snapshots.forEachSlot([maxBalls](WorldSnapshot &snapshot) { snapshot.sprites.reserve(maxBalls); });
+    }
+
+    // a neighbourhood of n balls has n * (n - 1) ordered pairs, it is resolved on a copy of n candidates
+    size_t neighbourhood = (size_t)std::ceil(std::sqrt((double)expectedPairs)) + 1;
+    for (unsigned slot = 0; slot < pool->getThreadCount(); slot++) {
+        arena.reserve(slot, neighbourhood * sizeof(Candidate));
+    }
+
+    capacity = maxBalls;
+    hardCapacity = hard;
+}
+
+size_t CollidingWorld::getDroppedCount(void) const { return dropped; }
+
+size_t CollidingWorld::getSubstitutedCount(void) const { return substituted; }
+
+WorldMemory CollidingWorld::memoryFootprint(void) const {
+    auto bytes = [](auto const &vec) { return vec.capacity() * sizeof(vec[0]); };
+    WorldMemory memory = {};
+    memory.balls = bytes(balls) + bytes(ballIds) + bytes(ballSlots) + bytes(slots) + bytes(freeSlots) +
+                   idSlots.getMemory() + bytes(materials) + bytes(materialUses) +
+                   sizeof(materialRadii);
+    memory.cells = bytes(cellBalls) + bytes(cellStart) + bytes(ballCells) + bytes(blockStart) +
+                   bytes(cellCounts) + bytes(collisionCounters);
+    for (unsigned slot = 0; slot < pool->getThreadCount(); slot++) memory.contacts += arena.getCapacity(slot);
+    memory.scratch = commands.getMemory() + arena.getCapacity(pool->getThreadCount());
+    snapshots.forEachSlot([&](WorldSnapshot const &snapshot) {
+        memory.snapshots += bytes(snapshot.sprites) + bytes(snapshot.cellStart);
+    });
+    return memory;
 }
 
 int CollidingWorld::getLastBallId(void) const { return lastId; }
 
 int CollidingWorld::getBallCount(void) const { return balls.size(); }
 
+Ball CollidingWorld::getBallAt(size_t index) const {
+    auto &body = balls[index];
+    auto &material = materials[body.material];
+    Ball ball(ballIds[index], material.radius, material.mass, material.color, getPosition(body), getVelocity(body),
+              Vector2Zero());
+    ball.shouldUpdate = body.shouldUpdate;
+    return ball;
+}
+
+BallMaterial const &CollidingWorld::getMaterial(uint8_t material) const { return materials[material]; }
+
+#ifndef BALLS_COMPACT
+Vector2 CollidingWorld::getPosition(BallBody const &body) const { return body.pos; }
+
+Vector2 CollidingWorld::getVelocity(BallBody const &body) const { return body.vel; }
+
+void CollidingWorld::setPosition(BallBody &body, Vector2 position) const { body.pos = position; }
+
+void CollidingWorld::setVelocity(BallBody &body, Vector2 velocity) const { body.vel = velocity; }
+#else
+Vector2 CollidingWorld::getPosition(BallBody const &body) const {
+    return {unpackAxis(body.cell[0], body.offset[0], cellSize), unpackAxis(body.cell[1], body.offset[1], cellSize)};
+}
+
+Vector2 CollidingWorld::getVelocity(BallBody const &body) const {
+    return {fromHalf(body.vel[0]), fromHalf(body.vel[1])};
+}
+
+// a compact ball cannot leave the world, it stops at its edge. Its cell is the world's and not the grid's.
+void CollidingWorld::setPosition(BallBody &body, Vector2 position) const {
+    packAxis(position.x, cellSize, gridSize.x, body.cell[0], body.offset[0]);
+    packAxis(position.y, cellSize, worldConstraint.y / cellSize + 1, body.cell[1], body.offset[1]);
+}
+
+void CollidingWorld::setVelocity(BallBody &body, Vector2 velocity) const {
+    body.vel[0] = toHalf(velocity.x);
+    body.vel[1] = toHalf(velocity.y);
+}
+#endif
+
+unsigned CollidingWorld::getThreadCount(void) const { return pool->getThreadCount(); }
+
+int CollidingWorld::getCellSize(void) const { return cellSize; }
+
+Vec2<int> CollidingWorld::getGridSize(void) const { return gridSize; }
+
+int CollidingWorld::getFirstRow(void) const { return firstRow; }
+
+Vec2<int> CollidingWorld::getWorldConstraint(void) const { return worldConstraint; }
+
 std::vector<Vec2<int>> CollidingWorld::getRelatedCoords(Vec2<int> pos) {
-    std::vector<Vec2<int>> possible = {pos,
-                                       {pos.x - 1, pos.y - 1},
-                                       {pos.x, pos.y - 1},
-                                       {pos.x + 1, pos.y - 1},
-                                       {pos.x + 1, pos.y},
-                                       {pos.x + 1, pos.y + 1},
-                                       {pos.x, pos.y + 1},
-                                       {pos.x - 1, pos.y + 1},
-                                       {pos.x - 1, pos.y}};
-    std::vector<Vec2<int>> result = {};
+    Vec2<int> coords[9];
+    auto count = getRelatedCoords(pos, coords);
+    return {coords, coords + count};
+}
+
+int CollidingWorld::getRelatedCoords(Vec2<int> pos, Vec2<int> (&coords)[9]) {
+    Vec2<int> possible[9] = {pos,
+                             {pos.x - 1, pos.y - 1},
+                             {pos.x, pos.y - 1},
+                             {pos.x + 1, pos.y - 1},
+                             {pos.x + 1, pos.y},
+                             {pos.x + 1, pos.y + 1},
+                             {pos.x, pos.y + 1},
+                             {pos.x - 1, pos.y + 1},
+                             {pos.x - 1, pos.y}};
+    int count = 0;
     for (auto &coord : possible) {
-        if (isValidCell(coord)) result.push_back(coord);
+        if (isValidCell(coord)) coords[count++] = coord;
     }
-    return possible;
+    return count;
 }
 
 Vec2<int> CollidingWorld::hash(Vector2 p) const { return {(int)p.x / cellSize, (int)p.y / cellSize}; }
 
+// cells are in the world's rows, a valid one is in the rows the grid keeps
 bool CollidingWorld::isValidCell(Vec2<int> cell) {
-    auto [wx, wy] = worldConstraint;
     auto [cx, cy] = cell;
-    auto width = wx / cellSize;
-    auto height = wy / cellSize;
-    return cx <= width && cx >= 0 && cy <= height && cy >= 0;
+    return cx < gridSize.x && cx >= 0 && cy < firstRow + gridSize.y && cy >= firstRow;
+}
+
+CollidingWorld::CellRange CollidingWorld::getCell(Vec2<int> cell) const {
+    auto data = cellBalls.data();
+    auto key = (cell.y - firstRow) * gridSize.x + cell.x;
+    return {data + cellStart[key], data + cellStart[key + 1]};
 }
 
 void CollidingWorld::buildCells(void) {
-    for (auto &[_, vec] : this->cells) {
-        vec.clear();
-    }
-    if (balls.size() != 0) {
-        for (size_t i = 0; i < balls.size(); i++) {
-            auto hash_pos = hash(balls[i].pos);
-            auto [a, b, c, d] = balls[i].getBounds();
-            std::unordered_set<Vec2<int>> coords = {hash_pos, hash(a), hash(b), hash(c), hash(d)};
-            bool added = false;
-
-            // we want to add the ball to every cell that it touches
-            for (auto &coord : coords) {
-                if (isValidCell(hash_pos)) {
-                    cells[hash_pos].push_back(&this->balls[i]);
-                    added = true;
-                }
+    // A counting sort of the balls by cell, every pass runs on the pool. Every ball lives only in the cell of
+    // its centre, resolving a cell looks at its neighbours as well. This keeps each ball in a single row,
+    // which the collide and sprite rows of the frame graph rely on.
+    size_t cellCount = gridSize.x * gridSize.y;
+    ballCells.resize(balls.size());
+    // the counters are plain integers so they can live on the world's pages, every pass goes through this
+    auto counter = [this](size_t cell) { return std::atomic_ref<uint32_t>(cellCounts[cell]); };
+
+    // the cell of every ball and how many balls each cell gets
+    pool->parallelFor(balls.size(), BUILD_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+#ifndef BALLS_COMPACT
+            auto cell = hash(balls[i].pos);
+#else
+            // compact balls know their cell already
+            Vec2<int> cell = {balls[i].cell[0], balls[i].cell[1]};
+#endif
+            if (!isValidCell(cell)) {
+                ballCells[i] = NO_CELL;
+                continue;
             }
-            if (!added) {
-                // std::cerr << "could not find cell for " << hash_pos.x << "," << hash_pos.y << "\n";
+            ballCells[i] = (cell.y - firstRow) * gridSize.x + cell.x;
+            counter(ballCells[i]).fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
+    // Prefix sum over the counts in blocks: every block adds up its cells, the block totals are summed up in
+    // order and then every block writes out its starts. The counters become the next free slot of each cell.
+    size_t blocks = blockStart.size();
+    size_t blockSize = (cellCount + blocks - 1) / blocks;
+    pool->parallelFor(blocks, 1, [&](size_t begin, size_t end) {
+        for (size_t block = begin; block < end; block++) {
+            uint32_t total = 0;
+            for (size_t c = block * blockSize; c < std::min(cellCount, (block + 1) * blockSize); c++) {
+                total += counter(c).load(std::memory_order_relaxed);
             }
+            blockStart[block] = total;
         }
+    });
+    uint32_t total = 0;
+    for (auto &start : blockStart) {
+        auto count = start;
+        start = total;
+        total += count;
     }
+    pool->parallelFor(blocks, 1, [&](size_t begin, size_t end) {
+        for (size_t block = begin; block < end; block++) {
+            auto start = blockStart[block];
+            for (size_t c = block * blockSize; c < std::min(cellCount, (block + 1) * blockSize); c++) {
+                auto count = counter(c).load(std::memory_order_relaxed);
+                cellStart[c] = start;
+                counter(c).store(start, std::memory_order_relaxed);
+                start += count;
+            }
+        }
+    });
+    cellStart[cellCount] = total;
+    cellBalls.resize(total);
+
+    pool->parallelFor(balls.size(), BUILD_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            if (ballCells[i] == NO_CELL) continue;
+            cellBalls[counter(ballCells[i]).fetch_add(1, std::memory_order_relaxed)] = i;
+        }
+    });
+
+    // the scatter fills a cell in whatever order the threads got there, put its balls back in their order in
+    // `balls` so a step does not depend on the thread count. Cells only hold a few balls.
+    pool->parallelFor(cellCount, BUILD_GRAIN, [&](size_t begin, size_t end) {
+        for (size_t c = begin; c < end; c++) {
+            std::sort(cellBalls.data() + cellStart[c], cellBalls.data() + cellStart[c + 1]);
+            counter(c).store(0, std::memory_order_relaxed);
+        }
+    });
 }
 
 bool CollidingWorld::checkBallCollision(Vec2<int> cell_pos, int id1, int id2) {
     if (id1 == id2) throw std::invalid_argument("ball ids cannot be the same");
     if (isValidCell(cell_pos)) {
-        std::unordered_set<int> ids = {id1, id2};
-        auto cell = cells[cell_pos];
-        for (auto &x : cell) {
-            for (auto &y : cell) {
-                std::unordered_set<int> set = {x->id, y->id};
-                // dont collide with the same ball
-                if (x->id != y->id && set == ids &&
-                    Vector2Distance(x->pos, y->pos) <= x->radius + y->radius) {
+        auto cell = getCell(cell_pos);
+        for (auto i : cell) {
+            for (auto j : cell) {
+                auto &x = balls[i], &y = balls[j];
+                // every pair comes up both ways round, so checking one order is enough
+                if (ballIds[i] == id1 && ballIds[j] == id2 &&
+                    Vector2Distance(getPosition(x), getPosition(y)) <=
+                        materialRadii[x.material] + materialRadii[y.material]) {
                     return true;
                 }
             }
@@ -96,149 +347,535 @@ bool CollidingWorld::checkBallCollision(Vec2<int> cell_pos, int id1, int id2) {
 
 void CollidingWorld::resolveCollisions(Vec2<int> pos) {
     if (isValidCell(pos)) {
-        auto coords = getRelatedCoords(pos);
-        std::unordered_set<Ball *> c = {};
-        for (auto &coord : coords) {
-            auto cell = cells[coord];
-            for (auto ball : cell) {
-                c.insert(ball);
+        Vec2<int> coords[9];
+        auto count = getRelatedCoords(pos, coords);
+        // Every ball is in exactly one cell, so the neighbourhood never holds a ball twice. It is resolved on a
+        // copy of the positions, which the compact build only has to unpack once, and the balls that moved
+        // are written back at the end.
+        FrameArena::Scope scratch(arena, pool->getCurrentSlot());
+        std::pmr::vector<Candidate> c(scratch.get());
+        size_t size = 0;
+        for (int i = 0; i < count; i++) size += getCell(coords[i]).end() - getCell(coords[i]).begin();
+        c.reserve(size);
+        auto &counters = collisionCounters[pool->getCurrentSlot()];
+        counters.pairs += size > 0 ? size * (size - 1) : 0;
+        for (int i = 0; i < count; i++) {
+            for (auto ball : getCell(coords[i])) {
+                auto &body = balls[ball];
+                c.push_back({&body, getPosition(body), materialRadii[body.material], false});
             }
         }
         for (auto &x : c) {
             for (auto &y : c) {
-                if (x->id != y->id && x->isCollidingWith(*y)) {
-                    std::cout << x->id << "," << y->id << " " << pos.x << "," << pos.y << "\n";
-                    auto r1 = x->radius, r2 = y->radius;
-                    auto p1 = x->pos, p2 = y->pos;
+                auto r1 = x.radius, r2 = y.radius;
+                if (&x != &y && Vector2Distance(x.pos, y.pos) <= r1 + r2) {
+                    counters.contacts++;
+                    auto p1 = x.pos, p2 = y.pos;
                     auto difference = Vector2Subtract(p1, p2);
                     auto rcap = Vector2Normalize(difference);
                     auto rIntersect = r1 + r2 - Vector2Distance(difference, Vector2Zero());
                     auto f1 = Vector2Add(Vector2Scale(rcap, rIntersect * 0.5), p1);
                     // auto f2 = Vector2Add(Vector2Scale(Vector2Negate(rcap), rIntersect * 0.5), p2);
-                    x->pos = f1;
-                    // y->pos = f2;
+                    x.pos = f1;
+                    x.moved = true;
+                    // y.pos = f2;
                 }
             }
         }
+        for (auto &x : c) {
+            if (x.moved) setPosition(*x.body, x.pos);
+        }
+    }
+}
+
+void CollidingWorld::collideRow(int row) {
+    if (!frameCollide) return;
+    // cells of a row that are 3 apart do not touch the same balls
+    for (int color = 0; color < 3; color++) {
+        size_t count = (gridSize.x - color + 2) / 3;
+        pool->parallelFor(count, COLLIDE_GRAIN, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) resolveCollisions({color + (int)i * 3, firstRow + row});
+        });
     }
 }
 
+void CollidingWorld::prepareRow(int row) {
+    auto sprite = snapshots.back().sprites.data();
+    for (auto i = cellStart[row * gridSize.x]; i < cellStart[(row + 1) * gridSize.x]; i++) {
+        sprite[i] = spriteOf(balls[cellBalls[i]]);
+    }
+}
+
+BallSprite CollidingWorld::spriteOf(BallBody const &ball) const {
+    return {getPosition(ball), materialRadii[ball.material], materials[ball.material].color};
+}
+
 void CollidingWorld::addBall(Ball ball) {
-    this->balls.push_back(ball);
-    lastId = ball.id;
+    if (ball.id < 0) throw std::invalid_argument("ball ids cannot be negative");
+    send({WorldCommand::Add, ball.id, {}, {}, ball});
+}
+
+void CollidingWorld::removeBall(int id) { send({WorldCommand::Remove, id, {}, {}, {}}); }
 
-    buildCells();
+void CollidingWorld::addBalls(std::span<Ball const> batch) {
+    for (auto &ball : batch) {
+        if (ball.id < 0) throw std::invalid_argument("ball ids cannot be negative");
+    }
+    auto payload = std::make_unique<WorldCommand::Batch>();
+    payload->balls.assign(batch.begin(), batch.end());
+    send({WorldCommand::AddBatch, -1, {}, {}, {}, std::move(payload)});
 }
 
-void CollidingWorld::removeBall(int id) {
-    if (balls.size() != 0) {
-        balls.erase(std::remove_if(balls.begin(), balls.end(), [id](Ball const &b) { return b.id == id; }));
-        lastId = balls.size() == 0 ? -1 : balls.back().id;
-        buildCells();
+void CollidingWorld::removeBalls(std::span<int const> ids) {
+    auto payload = std::make_unique<WorldCommand::Batch>();
+    payload->ids.assign(ids.begin(), ids.end());
+    send({WorldCommand::RemoveBatch, -1, {}, {}, {}, std::move(payload)});
+}
+
+void CollidingWorld::removeBalls(std::function<bool(Ball const &)> predicate) {
+    auto payload = std::make_unique<WorldCommand::Batch>();
+    payload->predicate = std::move(predicate);
+    send({WorldCommand::RemoveIf, -1, {}, {}, {}, std::move(payload)});
+}
+
+void CollidingWorld::applyImpulse(int id, Vector2 impulse) { send({WorldCommand::Impulse, id, impulse, {}, {}}); }
+
+void CollidingWorld::dragBall(int id, Vector2 pos) { send({WorldCommand::Drag, id, pos, {}, {}}); }
+
+uint8_t CollidingWorld::internMaterial(Ball const &ball) {
+    auto use = [this](size_t m) {
+        materialUses[m]++;
+        return (uint8_t)m;
+    };
+    // there are few materials and balls of one are usually added together, so start looking at the newest
+    for (size_t m = materials.size(); m-- > 0;) {
+        auto &material = materials[m];
+        if (material.radius == ball.radius && material.mass == ball.mass && material.color.r == ball.color.r &&
+            material.color.g == ball.color.g && material.color.b == ball.color.b &&
+            material.color.a == ball.color.a) {
+            return use(m);
+        }
     }
+    auto set = [&](size_t m) {
+        materials[m] = {ball.radius, ball.mass, ball.color};
+        materialRadii[m] = ball.radius;
+        return use(m);
+    };
+    // a material no ball uses any more is taken over before the table grows
+    for (size_t m = 0; m < materials.size(); m++) {
+        if (materialUses[m] == 0) return set(m);
+    }
+    if (materials.size() < 256) {
+        materials.emplace_back();
+        materialUses.push_back(0);
+        return set(materials.size() - 1);
+    }
+
+    // All 256 are in use, so the ball gets the closest one there is rather than a step that throws. The radius
+    // is what collides so it counts first, then the mass, then the colour.
+    auto distance = [&ball](BallMaterial const &material) {
+        int dr = material.color.r - ball.color.r, dg = material.color.g - ball.color.g;
+        int db = material.color.b - ball.color.b, da = material.color.a - ball.color.a;
+        return std::make_tuple(std::abs(material.radius - ball.radius), std::fabs(material.mass - ball.mass),
+                               dr * dr + dg * dg + db * db + da * da);
+    };
+    size_t nearest = 0;
+    for (size_t m = 1; m < materials.size(); m++) {
+        if (distance(materials[m]) < distance(materials[nearest])) nearest = m;
+    }
+    substituted++;
+    return use(nearest);
 }
 
-Ball *CollidingWorld::getSelected(void) {
-    if (selectedBall < (int)balls.size() && selectedBall >= 0) {
-        return &(this->balls[selectedBall]);
+void CollidingWorld::releaseMaterial(uint8_t material) { materialUses[material]--; }
+
+void CollidingWorld::insertBall(Ball const &ball) {
+    auto existing = findBall(ball.id);
+    // a hard reserve can be below what the world already holds, those balls stay until they are removed
+    if (hardCapacity && existing == nullptr && balls.size() >= capacity) {
+        dropped++;
+        return;
+    }
+    lastId = ball.id;
+    BallBody body = {};
+    setPosition(body, ball.pos);
+    setVelocity(body, ball.vel);
+    body.material = internMaterial(ball);
+    body.shouldUpdate = ball.shouldUpdate;
+    if (existing != nullptr) {
+        releaseMaterial(existing->material);
+        *existing = body;
+        return;
+    }
+
+    uint32_t slot;
+    if (!freeSlots.empty()) {
+        slot = freeSlots.back();
+        freeSlots.pop_back();
     } else {
-        return nullptr;
+        slot = slots.size();
+        slots.push_back({0, 0});
     }
+    slots[slot].ball = balls.size();
+    balls.push_back(body);
+    ballIds.push_back(ball.id);
+    ballSlots.push_back(slot);
+    idSlots.set(ball.id, slot);
 }
 
-void CollidingWorld::setSelected(Vector2 mousePos, BallSelectionType type) {
-    if (selectedBall == -1) {
-        for (auto &ball : balls) {
-            if (Vector2Distance(mousePos, ball.pos) <= ball.radius) {
-                selectedBall = ball.id;
+void CollidingWorld::insertBalls(std::vector<Ball> const &batch) {
+    // with a hard capacity everything is already as big as it gets, and insertBall drops what does not fit
+    if (hardCapacity) {
+        for (auto &ball : batch) insertBall(ball);
+        return;
+    }
+    // Grows at least geometrically, so a stream of small batches still only copies every ball a few times.
+    // Only reserve() sizes things exactly. The id map doubles by itself, and reserving it would keep it from
+    // shrinking again.
+    auto grow = [](auto &array, size_t needed) {
+        if (needed > array.capacity()) array.reserve(std::max(needed, 2 * array.capacity()));
+    };
+    grow(balls, balls.size() + batch.size());
+    grow(ballIds, balls.size() + batch.size());
+    grow(ballSlots, balls.size() + batch.size());
+    grow(slots, slots.size() + std::max(batch.size(), freeSlots.size()) - freeSlots.size());
+    for (auto &ball : batch) insertBall(ball);
+}
+
+void CollidingWorld::eraseBall(int id) {
+    auto slot = idSlots.get(id);
+    if (slot == IdMap::NONE) return;
+    auto index = slots[slot].ball;
+    releaseMaterial(balls[index].material);
+
+    // the last ball takes the place of the removed one, so nothing else has to move
+    balls[index] = balls.back();
+    ballIds[index] = ballIds.back();
+    ballSlots[index] = ballSlots.back();
+    slots[ballSlots[index]].ball = index;
+    balls.pop_back();
+    ballIds.pop_back();
+    ballSlots.pop_back();
+
+    // handles to the old ball see the new generation and find nothing
+    slots[slot].generation++;
+    freeSlots.push_back(slot);
+    idSlots.erase(id);
+    // The last id goes back to the newest ball that is left. Ids are usually handed out one after another so
+    // it is close below, but they do not have to be, and past a few misses the largest id left is taken.
+    for (int scanned = 0; lastId >= 0 && findBall(lastId) == nullptr; scanned++) {
+        if (scanned == LAST_ID_SCAN || lastId == 0) {
+            lastId = balls.empty() ? -1 : *std::max_element(ballIds.begin(), ballIds.end());
+            break;
+        }
+        lastId--;
+    }
+}
+
+BallBody *CollidingWorld::findBall(int id) {
+    auto slot = idSlots.get(id);
+    return slot != IdMap::NONE ? &balls[slots[slot].ball] : nullptr;
+}
+
+BallHandle CollidingWorld::getHandle(int id) const {
+    auto slot = idSlots.get(id);
+    if (slot == IdMap::NONE) return {};
+    return {slot, slots[slot].generation};
+}
+
+BallBody *CollidingWorld::getBall(BallHandle handle) {
+    if (handle.index >= slots.size() || slots[handle.index].generation != handle.generation) return nullptr;
+    return &balls[slots[handle.index].ball];
+}
+
+BallBody *CollidingWorld::getSelected(void) { return getBall(selected); }
+
+void CollidingWorld::select(Vector2 mousePos, BallSelectionType type) {
+    if (getSelected() == nullptr) {
+        for (size_t i = 0; i < balls.size(); i++) {
+            if (Vector2Distance(mousePos, getPosition(balls[i])) <= materialRadii[balls[i].material]) {
+                selected = {ballSlots[i], slots[ballSlots[i]].generation};
                 selectionType = type;
             }
         }
     }
 }
 
-void CollidingWorld::unsetSelected(void) {
-    auto selected = getSelected();
-    if (selectionType == BallSelectionType::Shoot && selected != nullptr) shooter = selected;
-    selectedBall = -1;
+void CollidingWorld::unselect(void) {
+    if (selectionType == BallSelectionType::Shoot) shooter = selected;
+    selected = {};
 }
 
+void CollidingWorld::setSelected(Vector2 mousePos, BallSelectionType type) {
+    send({WorldCommand::Select, -1, mousePos, type, {}});
+}
+
+void CollidingWorld::unsetSelected(void) { send({WorldCommand::Unselect, -1, {}, {}, {}}); }
+
 BallSelectionType CollidingWorld::getSelectionType(void) const { return selectionType; }
 
-void CollidingWorld::update(Vector2 mouseCoords, bool checkCollision) {
-    if (balls.size() != 0) {
-        buildCells();
+void CollidingWorld::applyInput(void) {
+    if (auto ball = getBall(shooter)) {
+        auto pos = getPosition(*ball);
+        setVelocity(*ball, Vector2Scale(Vector2Normalize(Vector2Subtract(pos, frameMouse)),
+                                        Vector2Distance(frameMouse, pos) * 10));
+    }
+    shooter = {};
+    // the dragged ball follows the mouse instead of being integrated
+    if (selectionType == BallSelectionType::Drag && getSelected() != nullptr) setPosition(*getSelected(), frameMouse);
+}
 
-        std::unordered_set<int> updated = {};
+void CollidingWorld::integrateChunk(size_t chunk, size_t chunks) {
+    if (!shouldUpdate) return;
+    // chunks own disjoint ranges of balls, cut at multiples of 16 to keep the vector kernels full
+    size_t size = (balls.size() / chunks + 16) & ~size_t(15);
+    size_t begin = std::min(balls.size(), chunk * size), end = std::min(balls.size(), begin + size);
+    if (begin == end) return;
 
-        for (auto &[pos, cell] : this->cells) {
-            for (auto &x : cell) {
-                if (shooter != nullptr) {
-                    shooter->vel = Vector2Scale(Vector2Normalize(Vector2Subtract(shooter->pos, mouseCoords)),
-                                                Vector2Distance(mouseCoords, shooter->pos) * 10);
-                    shooter = nullptr;
-                }
-                if (x->id == selectedBall && selectionType == BallSelectionType::Drag) {
-                    x->pos = mouseCoords;
-                } else if (shouldUpdate && updated.find(x->id) == updated.end()) {
-                    // update only if ball hasnt been updated in another cell before
-                    x->update();
-
-                    Vec2<bool> outbound = {x->pos.x >= worldConstraint.x - x->radius,
-                                           x->pos.y >= worldConstraint.y - x->radius};
-                    Vec2<bool> inbound = {x->pos.x - x->radius < 0, x->pos.y - x->radius < 0};
-
-                    const auto xfunc = [x]() {
-                        x->vel.x = -x->vel.x;
-                        x->acc.x = -x->acc.x;
-                    };
-                    const auto yfunc = [x]() {
-                        x->vel.y = -x->vel.y;
-                        x->acc.y = -x->acc.y;
-                    };
-
-                    if (outbound.x) {
-                        x->pos.x = worldConstraint.x - x->radius;
-                        xfunc();
-                    } else if (inbound.x) {
-                        x->pos.x = x->radius;
-                        xfunc();
-                    }
-
-                    if (outbound.y) {
-                        x->pos.y = worldConstraint.y - x->radius;
-                        yfunc();
-                    } else if (inbound.y) {
-                        x->pos.y = x->radius;
-                        yfunc();
-                    }
-                    updated.insert(x->id);
-                }
-            }
-            if (checkCollision) resolveCollisions(pos);
+    auto dragged = selectionType == BallSelectionType::Drag ? getSelected() : nullptr;
+    long skip = dragged != nullptr ? dragged - balls.data() : -1;
+    integrateBalls(&balls[begin], end - begin, materialRadii, frameDt, worldConstraint, cellSize,
+                   skip - (long)begin);
+}
+
+// marks the calling thread as the one stepping the world for as long as it exists
+class StepperScope {
+   public:
+    explicit StepperScope(std::atomic<std::thread::id> &s) : stepper(s) {
+        stepper.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    }
+    ~StepperScope() { stepper.store(std::thread::id(), std::memory_order_relaxed); }
+
+   private:
+    std::atomic<std::thread::id> &stepper;
+};
+
+void CollidingWorld::step(float dt) {
+    std::lock_guard<std::mutex> lock(stepping);
+    StepperScope scope(stepper);
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    arena.reset();
+    applyCommands();
+    frameDt = dt;
+    for (auto &counters : collisionCounters) counters = {};
+    auto run = Clock::now();
+    frame.run(*pool);
+    auto end = Clock::now();
+    if (!publishing) return;
+
+    auto seconds = [](Clock::duration d) { return std::chrono::duration<float>(d).count(); };
+    auto &stats = snapshots.back().stats;
+    stats.integrate = seconds(buildStart - run);
+    stats.buildCells = seconds(buildEnd - buildStart);
+    stats.collide = seconds(end - buildEnd);
+    stats.step = seconds(end - start);
+    stats.pairsTested = stats.contacts = 0;
+    for (auto &counters : collisionCounters) {
+        stats.pairsTested += counters.pairs;
+        stats.contacts += counters.contacts;
+    }
+    stats.memory = memoryFootprint().total();
+    stats.substituted = substituted;
+    publishSnapshot();
+}
+
+void CollidingWorld::publishSnapshot(void) {
+    auto &snapshot = snapshots.back();
+    // the sprite rows only cover balls in the grid, one dragged off it still gets drawn once at the end
+    if (cellBalls.size() < balls.size()) {
+        size_t next = cellBalls.size();
+        for (size_t i = 0; i < balls.size(); i++) {
+            if (ballCells[i] == NO_CELL) snapshot.sprites[next++] = spriteOf(balls[i]);
         }
     }
+    auto selected = getSelected();
+    snapshot.ballCount = balls.size();
+    snapshot.lastId = lastId;
+    snapshot.updating = shouldUpdate;
+    snapshot.hasSelected = selected != nullptr;
+    snapshot.selectedPos = selected != nullptr ? getPosition(*selected) : Vector2Zero();
+    snapshot.selectionType = selectionType;
+    snapshots.publish();
+}
+
+WorldSnapshot const &CollidingWorld::getSnapshot(void) const { return snapshots.front(); }
+
+#ifndef BALLS_HEADLESS
+void CollidingWorld::update(Vector2 mouseCoords, bool checkCollision) {
+    update(mouseCoords, checkCollision, GetFrameTime());
 }
 
 void CollidingWorld::update(Vector2 m) { update(m, false); }
+#endif
+
+void CollidingWorld::update(Vector2 mouseCoords, bool checkCollision, float dt) {
+    if (isSimulating()) {
+        pointer.back() = {mouseCoords, checkCollision};
+        pointer.publish();
+    } else {
+        frameMouse = mouseCoords;
+        frameCollide = checkCollision;
+        step(dt);
+    }
+    snapshots.read();
+}
+
+CollidingWorld::StepAwaiter::StepAwaiter(CollidingWorld &w, Vector2 m, float d, bool c)
+    : world(w), mouseCoords(m), dt(d), checkCollision(c), work(run, this) {}
 
-void CollidingWorld::toggleUpdate(void) { this->shouldUpdate = !this->shouldUpdate; }
+bool CollidingWorld::StepAwaiter::await_ready(void) const { return false; }
+
+bool CollidingWorld::StepAwaiter::await_suspend(std::coroutine_handle<> c) {
+    // with nobody to hand the step to, suspending would only mean resuming right away
+    if (world.getThreadCount() == 1) {
+        world.update(mouseCoords, checkCollision, dt);
+        return false;
+    }
+    caller = c;
+    world.pool->post(work);
+    return true;
+}
+
+void CollidingWorld::StepAwaiter::run(void *ctx) {
+    auto awaiter = static_cast<StepAwaiter *>(ctx);
+    awaiter->world.update(awaiter->mouseCoords, awaiter->checkCollision, awaiter->dt);
+    // the awaiter lives in the caller's frame, so it is gone once the caller carries on
+    awaiter->caller.resume();
+}
+
+CollidingWorld::StepAwaiter CollidingWorld::stepAsync(Vector2 mouseCoords, float dt, bool checkCollision) {
+    return {*this, mouseCoords, dt, checkCollision};
+}
+
+void CollidingWorld::toggleUpdate(void) { send({WorldCommand::ToggleUpdate, -1, {}, {}, {}}); }
 
 bool CollidingWorld::isUpdating(void) const { return this->shouldUpdate; }
 
+void CollidingWorld::send(WorldCommand command) {
+    auto self = std::this_thread::get_id();
+    if (stepper.load(std::memory_order_relaxed) == self) {
+        // Sent from inside a step, by a RemoveIf predicate say. The step cannot wait for itself, so past a full
+        // queue the command and everything this thread sends after it wait in overflow.
+        if (!overflow.empty() || !commands.push(std::move(command))) overflow.push_back(std::move(command));
+        return;
+    }
+    // A step empties the queue when it starts, but there may not be another step coming, on this thread or any
+    // other. So whoever finds the queue full waits for the running step, if there is one, and then makes room
+    // by applying what is queued so far.
+    while (!commands.push(std::move(command))) {
+        std::unique_lock<std::mutex> lock(stepping, std::try_to_lock);
+        if (lock.owns_lock()) {
+            StepperScope scope(stepper);
+            applyCommands();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void CollidingWorld::applyCommands(void) {
+    WorldCommand command;
+    while (commands.pop(command)) applyCommand(command);
+    // what the stepping thread sent into a full queue comes after everything it got into the queue before
+    auto late = std::move(overflow);
+    overflow.clear();
+    for (auto &command : late) applyCommand(command);
+}
+
+void CollidingWorld::applyCommand(WorldCommand &command) {
+    switch (command.type) {
+        case WorldCommand::Add:
+            insertBall(*command.ball);
+            break;
+        case WorldCommand::Remove:
+            eraseBall(command.id);
+            break;
+        case WorldCommand::AddBatch:
+            insertBalls(command.batch->balls);
+            break;
+        case WorldCommand::RemoveBatch:
+            for (auto id : command.batch->ids) eraseBall(id);
+            break;
+        case WorldCommand::RemoveIf:
+            // going backwards, the ball that takes the place of a removed one has been looked at already
+            for (size_t i = balls.size(); i-- > 0;) {
+                if (command.batch->predicate(getBallAt(i))) eraseBall(ballIds[i]);
+            }
+            break;
+        case WorldCommand::Impulse:
+            // a massless ball would fly off at an infinite speed
+            if (auto ball = findBall(command.id); ball != nullptr && materials[ball->material].mass > 0) {
+                setVelocity(*ball, Vector2Add(getVelocity(*ball),
+                                              Vector2Scale(command.vec, 1 / materials[ball->material].mass)));
+            }
+            break;
+        case WorldCommand::Drag:
+            if (auto ball = findBall(command.id)) setPosition(*ball, command.vec);
+            break;
+        case WorldCommand::Select:
+            select(command.vec, command.selectionType);
+            break;
+        case WorldCommand::Unselect:
+            unselect();
+            break;
+        case WorldCommand::ToggleUpdate:
+            shouldUpdate = !shouldUpdate;
+            break;
+    }
+}
+
+void CollidingWorld::simulate(int stepsPerSecond) {
+    using Clock = std::chrono::steady_clock;
+    auto interval = stepsPerSecond > 0
+                        ? std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / stepsPerSecond))
+                        : Clock::duration::zero();
+    auto last = Clock::now();
+    auto next = last;
+
+    while (simulating.load(std::memory_order_acquire)) {
+        auto &p = pointer.read();
+        frameMouse = p.mouse;
+        frameCollide = p.checkCollision;
+
+        auto now = Clock::now();
+        step(std::min(std::chrono::duration<float>(now - last).count(), MAX_STEP));
+        last = now;
+
+        if (interval != Clock::duration::zero()) {
+            // a step that ran late is not made up for, the next one just starts right away
+            next = std::max(next + interval, Clock::now());
+            std::this_thread::sleep_until(next);
+        }
+    }
+}
+
+void CollidingWorld::startSimulation(int stepsPerSecond) {
+    if (isSimulating()) return;
+    pointer.back() = {frameMouse, frameCollide};
+    pointer.publish();
+    simulating.store(true, std::memory_order_release);
+    simulation = std::thread([this, stepsPerSecond]() { simulate(stepsPerSecond); });
+}
+
+void CollidingWorld::stopSimulation(void) {
+    if (!isSimulating()) return;
+    simulating.store(false, std::memory_order_release);
+    simulation.join();
+}
+
+bool CollidingWorld::isSimulating(void) const { return simulating.load(std::memory_order_acquire); }
+
+#ifndef BALLS_HEADLESS
 void CollidingWorld::draw(void) {
     for (int i = 0; i < worldConstraint.x / cellSize; i++) {
         DrawLine(i * cellSize, 0, i * cellSize, worldConstraint.y, GRAY);
-        for (int j = 0; j < worldConstraint.y / cellSize; j++) {
-            DrawLine(0, j * cellSize, worldConstraint.x, j * cellSize, GRAY);
-        }
     }
-    for (auto &[cell, balls] : cells) {
-        for (auto &x : balls) {
-            x->draw();
-            // DrawText((std::to_string(cell.x) + "," + std::to_string(cell.y)).c_str(), x->pos.x, x->pos.y,
-            // 14,
-            //          WHITE);
-        }
+    for (int j = 0; j < worldConstraint.y / cellSize; j++) {
+        DrawLine(0, j * cellSize, worldConstraint.x, j * cellSize, GRAY);
     }
-}
\ No newline at end of file
+    for (auto &sprite : getSnapshot().sprites) {
+        DrawCircle(sprite.pos.x, sprite.pos.y, sprite.radius, sprite.color);
+    }
+}
+#endif
\ No newline at end of file
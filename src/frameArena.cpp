@@ -0,0 +1,57 @@
+#include "frameArena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+
+// A slot starts out empty and gets its buffer at the first reset after it was used, so the slots of threads
+// that never work for a world, as in a WorldBatch, cost nothing.
+FrameArena::Slot::Slot(void) : capacity(0), used(0), wanted(0) {}
+
+void *FrameArena::Slot::do_allocate(size_t bytes, size_t alignment) {
+    size_t start = (used + alignment - 1) & ~(alignment - 1);
+    wanted = std::max(wanted, start + bytes);
+    if (start + bytes <= capacity) {
+        used = start + bytes;
+        return buffer.get() + start;
+    }
+    // does not fit this step, new[] keeps to the default new alignment so only small alignments are asked for
+    overflow.push_back(std::make_unique<std::byte[]>(bytes + alignment));
+    auto address = reinterpret_cast<uintptr_t>(overflow.back().get());
+    return reinterpret_cast<void *>((address + alignment - 1) & ~(uintptr_t)(alignment - 1));
+}
+
+bool FrameArena::Slot::do_is_equal(std::pmr::memory_resource const &other) const noexcept { return this == &other; }
+
+FrameArena::Scope::Scope(FrameArena &arena, unsigned s) : slot(*arena.get(s)), used(slot.used) {}
+
+// wanted stays where it is, the most the scope needed at once still counts towards growing the buffer
+FrameArena::Scope::~Scope() { slot.used = used; }
+
+FrameArena::Slot *FrameArena::Scope::get(void) const { return &slot; }
+
+FrameArena::FrameArena(unsigned count) : slots(std::make_unique<Padded[]>(count)), slotCount(count) {}
+
+FrameArena::Slot *FrameArena::get(unsigned slot) { return &slots[slot].slot; }
+
+size_t FrameArena::getCapacity(unsigned slot) const { return slots[slot].slot.capacity; }
+
+void FrameArena::reserve(unsigned s, size_t bytes) {
+    auto &slot = slots[s].slot;
+    if (bytes <= slot.capacity) return;
+    slot.capacity = bytes;
+    slot.buffer = std::make_unique<std::byte[]>(slot.capacity);
+    slot.used = 0;
+}
+
+void FrameArena::reset(void) {
+    for (unsigned i = 0; i < slotCount; i++) {
+        auto &slot = slots[i].slot;
+        if (slot.wanted > slot.capacity) {
+            slot.capacity = std::max(slot.wanted, slot.capacity * 2);
+            slot.buffer = std::make_unique<std::byte[]>(slot.capacity);
+        }
+        slot.overflow.clear();
+        slot.used = 0;
+        slot.wanted = 0;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,99 @@
+// Runs a world with no window for a number of steps, as fast as it can, and reports how quickly it went.
+//     balls-headless [balls] [steps] [threads] [frames]
+// With frames every step is also drawn on the cpu, into frames00000.ppm and on for a path prefix or as raw
+// rgb24 on stdout for -, e.g. | ffmpeg -f rawvideo -pixel_format rgb24 -video_size 1920x1080 -i - out.mp4
+#ifdef BALLS_HEADLESS
+
+#include <math.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "balls.hpp"
+#include "softwareRenderer.hpp"
+
+// every step moves the world on by this much however long it took, so runs are the same on any machine
+constexpr float STEP_DT = 1 / 60.0f;
+constexpr int RADIUS = 5;
+// room each ball gets on average, about a fifth of it is covered
+constexpr int AREA_PER_BALL = 400;
+constexpr int FRAME_WIDTH = 1920;
+constexpr int FRAME_HEIGHT = 1080;
+
+int main(int argc, char **argv) {
+    int balls = argc > 1 ? atoi(argv[1]) : 100000;
+    int steps = argc > 2 ? atoi(argv[2]) : 1000;
+    int threads = argc > 3 ? atoi(argv[3]) : 0;
+    std::string frames = argc > 4 ? argv[4] : "";
+    if (balls <= 0 || steps <= 0 || threads < 0) {
+        std::cerr << "usage: balls-headless [balls] [steps] [threads] [frames]" << std::endl;
+        return 1;
+    }
+    // the numbers go to stderr when stdout carries the frames
+    bool rawFrames = frames == "-";
+    auto &report = rawFrames ? std::cerr : std::cout;
+#ifdef _WIN32
+    if (rawFrames) _setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+    int side = (int)sqrt((double)balls * AREA_PER_BALL) + 1;
+    CollidingWorld world(4 * RADIUS, Vec2<int>{side, side}, threads);
+
+    // the same scene every run
+    srand(1);
+    Color colors[] = {BLUE, RED, GREEN, YELLOW};
+    std::vector<Ball> initial;
+    initial.reserve(balls);
+    for (int i = 0; i < balls; i++) {
+        Vector2 pos = {(float)(rand() % side), (float)(rand() % side)};
+        Vector2 vel = {(float)(rand() % 200 - 100), (float)(rand() % 200 - 100)};
+        initial.push_back(Ball(i, RADIUS, RADIUS, colors[rand() % 4], pos, vel, Vector2Zero()));
+    }
+    world.addBalls(initial);
+    // the first step adds the balls and grows every buffer to fit them, so it is left out of the timing
+    world.update(Vector2Zero(), true, STEP_DT);
+
+    // the renderer has a pool of its own, which sleeps while the world steps
+    std::unique_ptr<SoftwareRenderer> renderer;
+    if (!frames.empty()) renderer = std::make_unique<SoftwareRenderer>(FRAME_WIDTH, FRAME_HEIGHT, threads);
+
+    using Clock = std::chrono::steady_clock;
+    double seconds = 0, drawSeconds = 0;
+    for (int i = 0; i < steps; i++) {
+        auto start = Clock::now();
+        world.update(Vector2Zero(), true, STEP_DT);
+        auto stepped = Clock::now();
+        seconds += std::chrono::duration<double>(stepped - start).count();
+        if (!renderer) continue;
+
+        renderer->draw(world);
+        drawSeconds += std::chrono::duration<double>(Clock::now() - stepped).count();
+        if (rawFrames) {
+            renderer->writeRaw(std::cout);
+        } else {
+            char number[16];
+            snprintf(number, sizeof(number), "%05d.ppm", i);
+            renderer->savePpm(frames + number);
+        }
+    }
+
+    report << world.getBallCount() << " balls, " << steps << " steps on " << world.getThreadCount()
+           << " threads in " << seconds << "s" << std::endl;
+    report << steps / seconds << " steps/s, " << balls * (steps / seconds) << " ball steps/s" << std::endl;
+    if (renderer) {
+        report << steps / drawSeconds << " frames/s drawn at " << FRAME_WIDTH << "x" << FRAME_HEIGHT << std::endl;
+    }
+    return 0;
+}
+
+#endif  // BALLS_HEADLESS
\ No newline at end of file
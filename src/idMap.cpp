@@ -0,0 +1,77 @@
+#include "idMap.hpp"
+
+#include <algorithm>
+#include <utility>
+
+// smallest table, and the table never gets more than half full so probes stay short
+constexpr size_t MIN_CAPACITY = 16;
+
+size_t IdMap::home(int id) const {
+    // ids are often handed out one after another or in steps of some power of two, the multiply and the
+    // shift spread both over the whole table
+    uint32_t hash = (uint32_t)id * 2654435769u;
+    return (hash ^ hash >> 16) & (entries.size() - 1);
+}
+
+uint32_t IdMap::get(int id) const {
+    if (entries.empty() || id < 0) return NONE;
+    for (size_t i = home(id);; i = (i + 1) & (entries.size() - 1)) {
+        if (entries[i].id == id) return entries[i].slot;
+        if (entries[i].id < 0) return NONE;
+    }
+}
+
+void IdMap::set(int id, uint32_t slot) {
+    if ((count + 1) * 2 > entries.size()) rehash(std::max(MIN_CAPACITY, entries.size() * 2));
+    size_t i = home(id);
+    while (entries[i].id >= 0 && entries[i].id != id) i = (i + 1) & (entries.size() - 1);
+    if (entries[i].id < 0) count++;
+    entries[i] = {id, slot};
+}
+
+void IdMap::erase(int id) {
+    if (entries.empty() || id < 0) return;
+    size_t mask = entries.size() - 1;
+    size_t i = home(id);
+    while (entries[i].id != id) {
+        if (entries[i].id < 0) return;
+        i = (i + 1) & mask;
+    }
+    // Moves every following entry that would not be found past the hole into it, until the run of entries
+    // ends. That leaves the table as if the id had never been there.
+    for (size_t j = (i + 1) & mask; entries[j].id >= 0; j = (j + 1) & mask) {
+        size_t wanted = home(entries[j].id);
+        // whether wanted lies cyclically in (i, j], in which case the entry is fine where it is
+        bool reachable = i <= j ? (wanted > i && wanted <= j) : (wanted > i || wanted <= j);
+        if (reachable) continue;
+        entries[i] = entries[j];
+        i = j;
+    }
+    entries[i].id = -1;
+    count--;
+    // give memory back once most of the ids are gone, but never below what was reserved
+    if (entries.size() > std::max(MIN_CAPACITY, reserved) && count * 8 < entries.size()) {
+        rehash(entries.size() / 2);
+    }
+}
+
+void IdMap::reserve(size_t n) {
+    size_t capacity = MIN_CAPACITY;
+    while (capacity < n * 2) capacity *= 2;
+    reserved = std::max(reserved, capacity);
+    if (capacity > entries.size()) rehash(capacity);
+}
+
+size_t IdMap::size(void) const { return count; }
+
+size_t IdMap::getMemory(void) const { return entries.capacity() * sizeof(Entry); }
+
+void IdMap::rehash(size_t capacity) {
+    auto old = std::exchange(entries, std::vector<Entry>(capacity, {-1, NONE}));
+    for (auto &entry : old) {
+        if (entry.id < 0) continue;
+        size_t i = home(entry.id);
+        while (entries[i].id >= 0) i = (i + 1) & (capacity - 1);
+        entries[i] = entry;
+    }
+}
\ No newline at end of file
@@ -0,0 +1,374 @@
+#include "integrator.hpp"
+
+#include <cstddef>
+#include <cstring>
+
+#include "compact.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BALLS_X86
+#endif
+
+#ifdef BALLS_X86
+// pointer to the given member of the first ball, the lanes are then gathered at multiples of the body size
+template <typename T>
+static T *member(BallBody *balls, size_t offset) {
+    return reinterpret_cast<T *>(reinterpret_cast<char *>(balls) + offset);
+}
+#endif
+
+#ifndef BALLS_COMPACT
+
+// the vector kernels gather straight out of the body array, so these have to stay 4 byte aligned
+static_assert(sizeof(BallBody) % sizeof(float) == 0);
+static_assert(offsetof(BallBody, pos) % sizeof(float) == 0 && offsetof(BallBody, vel) % sizeof(float) == 0);
+// material and shouldUpdate are loaded together as one 32 bit lane, so they have to share a 4 byte word
+static_assert(offsetof(BallBody, material) % sizeof(int) == 0 &&
+              offsetof(BallBody, shouldUpdate) == offsetof(BallBody, material) + 1);
+static_assert(offsetof(BallBody, material) + sizeof(int) <= sizeof(BallBody));
+
+static void integrateScalar(BallBody *balls, size_t count, float const *radii, float dt, Vec2<int> wc, int,
+                            long skip) {
+    for (size_t i = 0; i < count; i++) {
+        if ((long)i == skip) continue;
+        auto x = &balls[i];
+        auto radius = radii[x->material];
+        if (x->shouldUpdate) {
+            x->vel = Vector2Add(x->vel, Vector2Scale(x->vel, BALL_DRAG));
+            x->pos = Vector2Add(x->pos, Vector2Scale(x->vel, dt));
+        }
+
+        if (x->pos.x >= wc.x - radius) {
+            x->pos.x = wc.x - radius;
+            x->vel.x = -x->vel.x;
+        } else if (x->pos.x - radius < 0) {
+            x->pos.x = radius;
+            x->vel.x = -x->vel.x;
+        }
+
+        if (x->pos.y >= wc.y - radius) {
+            x->pos.y = wc.y - radius;
+            x->vel.y = -x->vel.y;
+        } else if (x->pos.y - radius < 0) {
+            x->pos.y = radius;
+            x->vel.y = -x->vel.y;
+        }
+    }
+}
+
+#ifdef BALLS_X86
+
+constexpr int kStride = sizeof(BallBody) / sizeof(float);
+
+__attribute__((target("avx2"))) static size_t integrateAvx2(BallBody *balls, size_t count, float const *radii,
+                                                            float dt, Vec2<int> wc, int, long skip) {
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i index = _mm256_mullo_epi32(lane, _mm256_set1_epi32(kStride));
+    const __m256 drag = _mm256_set1_ps(BALL_DRAG), step = _mm256_set1_ps(dt);
+    const __m256 width = _mm256_set1_ps(wc.x), height = _mm256_set1_ps(wc.y);
+    const __m256 zero = _mm256_setzero_ps(), sign = _mm256_set1_ps(-0.0f);
+
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        auto b = &balls[i];
+        auto pos = member<float>(b, offsetof(BallBody, pos));
+        auto vel = member<float>(b, offsetof(BallBody, vel));
+
+        __m256 px = _mm256_i32gather_ps(pos, index, 4), py = _mm256_i32gather_ps(pos + 1, index, 4);
+        __m256 vx = _mm256_i32gather_ps(vel, index, 4), vy = _mm256_i32gather_ps(vel + 1, index, 4);
+        // the low byte is the material and the next one shouldUpdate
+        __m256i flags = _mm256_i32gather_epi32(member<int>(b, offsetof(BallBody, material)), index, 4);
+        __m256 r = _mm256_i32gather_ps(radii, _mm256_and_si256(flags, _mm256_set1_epi32(0xff)), 4);
+
+        // lanes that belong to the dragged ball keep their old values
+        __m256 live = _mm256_castsi256_ps(_mm256_xor_si256(
+            _mm256_cmpeq_epi32(_mm256_add_epi32(lane, _mm256_set1_epi32((int)i)), _mm256_set1_epi32((int)skip)),
+            _mm256_set1_epi32(-1)));
+        __m256 update = _mm256_andnot_ps(
+            _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(flags, _mm256_set1_epi32(0xff00)),
+                                                   _mm256_setzero_si256())),
+            live);
+
+        __m256 nvx = _mm256_add_ps(vx, _mm256_mul_ps(vx, drag)), nvy = _mm256_add_ps(vy, _mm256_mul_ps(vy, drag));
+        vx = _mm256_blendv_ps(vx, nvx, update);
+        vy = _mm256_blendv_ps(vy, nvy, update);
+        px = _mm256_blendv_ps(px, _mm256_add_ps(px, _mm256_mul_ps(nvx, step)), update);
+        py = _mm256_blendv_ps(py, _mm256_add_ps(py, _mm256_mul_ps(nvy, step)), update);
+
+        // walls, the far side wins when a ball is wider than the world just like in the scalar loop
+        __m256 farX = _mm256_sub_ps(width, r), farY = _mm256_sub_ps(height, r);
+        __m256 outX = _mm256_and_ps(_mm256_cmp_ps(px, farX, _CMP_GE_OQ), live);
+        __m256 outY = _mm256_and_ps(_mm256_cmp_ps(py, farY, _CMP_GE_OQ), live);
+        __m256 inX = _mm256_andnot_ps(outX, _mm256_and_ps(_mm256_cmp_ps(_mm256_sub_ps(px, r), zero, _CMP_LT_OQ), live));
+        __m256 inY = _mm256_andnot_ps(outY, _mm256_and_ps(_mm256_cmp_ps(_mm256_sub_ps(py, r), zero, _CMP_LT_OQ), live));
+        px = _mm256_blendv_ps(_mm256_blendv_ps(px, farX, outX), r, inX);
+        py = _mm256_blendv_ps(_mm256_blendv_ps(py, farY, outY), r, inY);
+        __m256 flipX = _mm256_and_ps(_mm256_or_ps(outX, inX), sign);
+        __m256 flipY = _mm256_and_ps(_mm256_or_ps(outY, inY), sign);
+        vx = _mm256_xor_ps(vx, flipX);
+        vy = _mm256_xor_ps(vy, flipY);
+
+        // avx2 has no scatter, so write the lanes back one ball at a time
+        alignas(32) float out[4][8];
+        _mm256_store_ps(out[0], px);
+        _mm256_store_ps(out[1], py);
+        _mm256_store_ps(out[2], vx);
+        _mm256_store_ps(out[3], vy);
+        for (int k = 0; k < 8; k++) {
+            b[k].pos = {out[0][k], out[1][k]};
+            b[k].vel = {out[2][k], out[3][k]};
+        }
+    }
+    return i;
+}
+
+// gcc's _mm512_undefined_* trips -Wmaybe-uninitialized once the gathers are inlined
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+// flips the sign of the lanes in k, avx512f has no float xor
+__attribute__((target("avx512f"))) static inline __m512 negate512(__m512 v, __mmask16 k) {
+    auto bits = _mm512_castps_si512(v);
+    return _mm512_castsi512_ps(_mm512_mask_xor_epi32(bits, k, bits, _mm512_set1_epi32(0x80000000)));
+}
+
+__attribute__((target("avx512f"))) static size_t integrateAvx512(BallBody *balls, size_t count,
+                                                                 float const *radii, float dt, Vec2<int> wc, int,
+                                                                 long skip) {
+    const __m512i lane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i index = _mm512_mullo_epi32(lane, _mm512_set1_epi32(kStride));
+    const __m512 drag = _mm512_set1_ps(BALL_DRAG), step = _mm512_set1_ps(dt);
+    const __m512 width = _mm512_set1_ps(wc.x), height = _mm512_set1_ps(wc.y);
+    const __m512 zero = _mm512_setzero_ps();
+
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        auto b = &balls[i];
+        auto pos = member<float>(b, offsetof(BallBody, pos));
+        auto vel = member<float>(b, offsetof(BallBody, vel));
+
+        __m512 px = _mm512_i32gather_ps(index, pos, 4), py = _mm512_i32gather_ps(index, pos + 1, 4);
+        __m512 vx = _mm512_i32gather_ps(index, vel, 4), vy = _mm512_i32gather_ps(index, vel + 1, 4);
+        __m512i flags = _mm512_i32gather_epi32(index, member<int>(b, offsetof(BallBody, material)), 4);
+        __m512 r = _mm512_i32gather_ps(_mm512_and_si512(flags, _mm512_set1_epi32(0xff)), radii, 4);
+
+        __mmask16 live = _mm512_cmpneq_epi32_mask(_mm512_add_epi32(lane, _mm512_set1_epi32((int)i)),
+                                                  _mm512_set1_epi32((int)skip));
+        __mmask16 update = _mm512_mask_test_epi32_mask(live, flags, _mm512_set1_epi32(0xff00));
+
+        __m512 nvx = _mm512_add_ps(vx, _mm512_mul_ps(vx, drag)), nvy = _mm512_add_ps(vy, _mm512_mul_ps(vy, drag));
+        vx = _mm512_mask_blend_ps(update, vx, nvx);
+        vy = _mm512_mask_blend_ps(update, vy, nvy);
+        px = _mm512_mask_add_ps(px, update, px, _mm512_mul_ps(vx, step));
+        py = _mm512_mask_add_ps(py, update, py, _mm512_mul_ps(vy, step));
+
+        __m512 farX = _mm512_sub_ps(width, r), farY = _mm512_sub_ps(height, r);
+        __mmask16 outX = _mm512_mask_cmp_ps_mask(live, px, farX, _CMP_GE_OQ);
+        __mmask16 outY = _mm512_mask_cmp_ps_mask(live, py, farY, _CMP_GE_OQ);
+        __mmask16 inX = _mm512_mask_cmp_ps_mask(live & ~outX, _mm512_sub_ps(px, r), zero, _CMP_LT_OQ);
+        __mmask16 inY = _mm512_mask_cmp_ps_mask(live & ~outY, _mm512_sub_ps(py, r), zero, _CMP_LT_OQ);
+        px = _mm512_mask_blend_ps(inX, _mm512_mask_blend_ps(outX, px, farX), r);
+        py = _mm512_mask_blend_ps(inY, _mm512_mask_blend_ps(outY, py, farY), r);
+
+        vx = negate512(vx, outX | inX);
+        vy = negate512(vy, outY | inY);
+
+        _mm512_mask_i32scatter_ps(pos, live, index, px, 4);
+        _mm512_mask_i32scatter_ps(pos + 1, live, index, py, 4);
+        _mm512_mask_i32scatter_ps(vel, live, index, vx, 4);
+        _mm512_mask_i32scatter_ps(vel + 1, live, index, vy, 4);
+    }
+    return i;
+}
+
+#pragma GCC diagnostic pop
+
+#endif  // BALLS_X86
+
+#else
+
+// the vector kernel reads a body as four 32 bit words, cell, offset, vel and then material and shouldUpdate
+static_assert(sizeof(BallBody) == 14);
+static_assert(offsetof(BallBody, cell) == 0 && offsetof(BallBody, offset) == 4 && offsetof(BallBody, vel) == 8);
+static_assert(offsetof(BallBody, material) == 12 && offsetof(BallBody, shouldUpdate) == 13);
+
+static void integrateScalar(BallBody *balls, size_t count, float const *radii, float dt, Vec2<int> wc,
+                            int cellSize, long skip) {
+    int columns = wc.x / cellSize + 1, rows = wc.y / cellSize + 1;
+    for (size_t i = 0; i < count; i++) {
+        if ((long)i == skip) continue;
+        auto x = &balls[i];
+        auto radius = radii[x->material];
+        float px = unpackAxis(x->cell[0], x->offset[0], cellSize), py = unpackAxis(x->cell[1], x->offset[1], cellSize);
+        float vx = fromHalf(x->vel[0]), vy = fromHalf(x->vel[1]);
+        if (x->shouldUpdate) {
+            vx = vx + vx * BALL_DRAG;
+            vy = vy + vy * BALL_DRAG;
+            px = px + vx * dt;
+            py = py + vy * dt;
+        }
+
+        if (px >= wc.x - radius) {
+            px = wc.x - radius;
+            vx = -vx;
+        } else if (px - radius < 0) {
+            px = radius;
+            vx = -vx;
+        }
+
+        if (py >= wc.y - radius) {
+            py = wc.y - radius;
+            vy = -vy;
+        } else if (py - radius < 0) {
+            py = radius;
+            vy = -vy;
+        }
+
+        packAxis(px, cellSize, columns, x->cell[0], x->offset[0]);
+        packAxis(py, cellSize, rows, x->cell[1], x->offset[1]);
+        x->vel[0] = toHalf(vx);
+        x->vel[1] = toHalf(vy);
+    }
+}
+
+#ifdef BALLS_X86
+
+// packAxis on 8 lanes, cell and offset come back in the low 16 bits of every lane
+__attribute__((target("avx2"))) static inline void packAxis8(__m256 p, __m256 size, __m256 limit, __m256 perStep,
+                                                             __m256i last, __m256i &cell, __m256i &offset) {
+    p = _mm256_max_ps(_mm256_min_ps(p, limit), _mm256_setzero_ps());
+    cell = _mm256_min_epi32(_mm256_cvttps_epi32(_mm256_div_ps(p, size)), last);
+    __m256 inside = _mm256_sub_ps(p, _mm256_mul_ps(_mm256_cvtepi32_ps(cell), size));
+    offset = _mm256_cvtps_epi32(_mm256_mul_ps(inside, perStep));
+    offset = _mm256_max_epi32(_mm256_min_epi32(offset, _mm256_set1_epi32(0xffff)), _mm256_setzero_si256());
+}
+
+// The same steps as the scalar loop 8 balls at a time. A body is loaded as 16 bytes, running 2 bytes into the
+// next ball, and 8 of them are transposed so every register holds one 32 bit field of 8 balls. The fields are
+// widened to floats in registers and narrowed again on the way out.
+__attribute__((target("avx2,f16c"))) static size_t integrateCompactAvx2(BallBody *balls, size_t count,
+                                                                     float const *radii, float dt, Vec2<int> wc,
+                                                                     int cellSize, long skip) {
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 drag = _mm256_set1_ps(BALL_DRAG), step = _mm256_set1_ps(dt);
+    const __m256 width = _mm256_set1_ps(wc.x), height = _mm256_set1_ps(wc.y);
+    const __m256 zero = _mm256_setzero_ps(), sign = _mm256_set1_ps(-0.0f);
+    const __m256i low = _mm256_set1_epi32(0xffff);
+
+    int columns = wc.x / cellSize + 1, rows = wc.y / cellSize + 1;
+    const __m256 size = _mm256_set1_ps((float)cellSize), stepSize = _mm256_set1_ps((float)cellSize / CELL_STEPS);
+    const __m256 perStep = _mm256_set1_ps(CELL_STEPS / (float)cellSize);
+    const __m256 limitX = _mm256_set1_ps((float)columns * (float)cellSize);
+    const __m256 limitY = _mm256_set1_ps((float)rows * (float)cellSize);
+    const __m256i lastX = _mm256_set1_epi32(columns - 1), lastY = _mm256_set1_epi32(rows - 1);
+
+    size_t i = 0;
+    // the ball after the 8 has to be there too, the last load reads into it
+    for (; i + 8 < count; i += 8) {
+        auto b = &balls[i];
+        __m128i body[8];
+        for (int k = 0; k < 8; k++) body[k] = _mm_loadu_si128(reinterpret_cast<__m128i const *>(&b[k]));
+        __m256i t0 = _mm256_inserti128_si256(_mm256_castsi128_si256(body[0]), body[4], 1);
+        __m256i t1 = _mm256_inserti128_si256(_mm256_castsi128_si256(body[1]), body[5], 1);
+        __m256i t2 = _mm256_inserti128_si256(_mm256_castsi128_si256(body[2]), body[6], 1);
+        __m256i t3 = _mm256_inserti128_si256(_mm256_castsi128_si256(body[3]), body[7], 1);
+        __m256i u0 = _mm256_unpacklo_epi32(t0, t1), u1 = _mm256_unpackhi_epi32(t0, t1);
+        __m256i u2 = _mm256_unpacklo_epi32(t2, t3), u3 = _mm256_unpackhi_epi32(t2, t3);
+        __m256i cells = _mm256_unpacklo_epi64(u0, u2), offsets = _mm256_unpackhi_epi64(u0, u2);
+        __m256i vels = _mm256_unpacklo_epi64(u1, u3);
+        // the low byte is the material and the next one shouldUpdate
+        __m256i flags = _mm256_unpackhi_epi64(u1, u3);
+        __m256 r = _mm256_i32gather_ps(radii, _mm256_and_si256(flags, _mm256_set1_epi32(0xff)), 4);
+
+        __m256 px = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(cells, low)), size),
+                                  _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_and_si256(offsets, low)), stepSize));
+        __m256 py = _mm256_add_ps(_mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(cells, 16)), size),
+                                  _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(offsets, 16)), stepSize));
+        // packing the x halves next to the y halves leaves them interleaved by 128 bit lane, the permute
+        // puts all x halves in the low half and all y halves in the high one
+        __m256i halves = _mm256_permute4x64_epi64(
+            _mm256_packus_epi32(_mm256_and_si256(vels, low), _mm256_srli_epi32(vels, 16)), 0xd8);
+        __m256 vx = _mm256_cvtph_ps(_mm256_castsi256_si128(halves));
+        __m256 vy = _mm256_cvtph_ps(_mm256_extracti128_si256(halves, 1));
+
+        __m256 live = _mm256_castsi256_ps(_mm256_xor_si256(
+            _mm256_cmpeq_epi32(_mm256_add_epi32(lane, _mm256_set1_epi32((int)i)), _mm256_set1_epi32((int)skip)),
+            _mm256_set1_epi32(-1)));
+        __m256 update = _mm256_andnot_ps(
+            _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(flags, _mm256_set1_epi32(0xff00)),
+                                                   _mm256_setzero_si256())),
+            live);
+
+        __m256 nvx = _mm256_add_ps(vx, _mm256_mul_ps(vx, drag)), nvy = _mm256_add_ps(vy, _mm256_mul_ps(vy, drag));
+        vx = _mm256_blendv_ps(vx, nvx, update);
+        vy = _mm256_blendv_ps(vy, nvy, update);
+        px = _mm256_blendv_ps(px, _mm256_add_ps(px, _mm256_mul_ps(nvx, step)), update);
+        py = _mm256_blendv_ps(py, _mm256_add_ps(py, _mm256_mul_ps(nvy, step)), update);
+
+        __m256 farX = _mm256_sub_ps(width, r), farY = _mm256_sub_ps(height, r);
+        __m256 outX = _mm256_and_ps(_mm256_cmp_ps(px, farX, _CMP_GE_OQ), live);
+        __m256 outY = _mm256_and_ps(_mm256_cmp_ps(py, farY, _CMP_GE_OQ), live);
+        __m256 inX = _mm256_andnot_ps(outX, _mm256_and_ps(_mm256_cmp_ps(_mm256_sub_ps(px, r), zero, _CMP_LT_OQ), live));
+        __m256 inY = _mm256_andnot_ps(outY, _mm256_and_ps(_mm256_cmp_ps(_mm256_sub_ps(py, r), zero, _CMP_LT_OQ), live));
+        px = _mm256_blendv_ps(_mm256_blendv_ps(px, farX, outX), r, inX);
+        py = _mm256_blendv_ps(_mm256_blendv_ps(py, farY, outY), r, inY);
+        vx = _mm256_xor_ps(vx, _mm256_and_ps(_mm256_or_ps(outX, inX), sign));
+        vy = _mm256_xor_ps(vy, _mm256_and_ps(_mm256_or_ps(outY, inY), sign));
+
+        __m256i cellX, cellY, offsetX, offsetY;
+        packAxis8(px, size, limitX, perStep, lastX, cellX, offsetX);
+        packAxis8(py, size, limitY, perStep, lastY, cellY, offsetY);
+        cells = _mm256_or_si256(cellX, _mm256_slli_epi32(cellY, 16));
+        offsets = _mm256_or_si256(offsetX, _mm256_slli_epi32(offsetY, 16));
+        __m128i halfX = _mm256_cvtps_ph(vx, _MM_FROUND_TO_NEAREST_INT);
+        __m128i halfY = _mm256_cvtps_ph(vy, _MM_FROUND_TO_NEAREST_INT);
+        vels = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_unpacklo_epi16(halfX, halfY)),
+                                       _mm_unpackhi_epi16(halfX, halfY), 1);
+
+        // transpose back, flags still holds the 2 bytes of the next ball that every load ran into
+        __m256i p0 = _mm256_unpacklo_epi32(cells, offsets), p1 = _mm256_unpackhi_epi32(cells, offsets);
+        __m256i q0 = _mm256_unpacklo_epi32(vels, flags), q1 = _mm256_unpackhi_epi32(vels, flags);
+        __m256i r0 = _mm256_unpacklo_epi64(p0, q0), r1 = _mm256_unpackhi_epi64(p0, q0);
+        __m256i r2 = _mm256_unpacklo_epi64(p1, q1), r3 = _mm256_unpackhi_epi64(p1, q1);
+        __m128i out[8] = {_mm256_castsi256_si128(r0),      _mm256_castsi256_si128(r1),
+                          _mm256_castsi256_si128(r2),      _mm256_castsi256_si128(r3),
+                          _mm256_extracti128_si256(r0, 1), _mm256_extracti128_si256(r1, 1),
+                          _mm256_extracti128_si256(r2, 1), _mm256_extracti128_si256(r3, 1)};
+        if (skip >= (long)i && skip < (long)i + 8) out[skip - i] = body[skip - i];
+        // In order, so the 2 bytes a store puts into the next ball are overwritten by that ball's own store.
+        // The last ball may belong to another thread's chunk and only gets its 12 bytes of cell, offset and vel.
+        for (int k = 0; k < 7; k++) _mm_storeu_si128(reinterpret_cast<__m128i *>(&b[k]), out[k]);
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(&b[7]), out[7]);
+        uint32_t vel = _mm_extract_epi32(out[7], 2);
+        std::memcpy(b[7].vel, &vel, sizeof(vel));
+    }
+    return i;
+}
+
+#endif  // BALLS_X86
+
+#endif  // BALLS_COMPACT
+
+using Kernel = size_t (*)(BallBody *, size_t, float const *, float, Vec2<int>, int, long);
+
+static Kernel selectKernel(void) {
+#ifdef BALLS_X86
+    __builtin_cpu_init();
+#ifndef BALLS_COMPACT
+    if (__builtin_cpu_supports("avx512f")) return integrateAvx512;
+    if (__builtin_cpu_supports("avx2")) return integrateAvx2;
+#else
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c")) return integrateCompactAvx2;
+#endif
+#endif
+    return nullptr;
+}
+
+void integrateBalls(BallBody *balls, size_t count, float const *radii, float dt, Vec2<int> worldConstraint,
+                    int cellSize, long skipIndex) {
+    static const Kernel kernel = selectKernel();
+
+    size_t done = kernel != nullptr ? kernel(balls, count, radii, dt, worldConstraint, cellSize, skipIndex) : 0;
+    integrateScalar(balls + done, count - done, radii, dt, worldConstraint, cellSize, skipIndex - (long)done);
+}
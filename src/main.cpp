@@ -1,9 +1,14 @@
+// the headless build has its own main in headless.cpp
+#ifndef BALLS_HEADLESS
+
 #include <time.h>
 
 #include <iostream>
-#include <string>
+#include <memory>
 
 #include "balls.hpp"
+#include "perfOverlay.hpp"
+#include "worldRenderer.hpp"
 
 int main(void) {
     srand(time(NULL));
@@ -24,21 +29,50 @@ int main(void) {
         return Ball(id, radius, radius, color, pos, vel, acc);
     };
 
+    std::vector<Ball> initial;
     for (size_t i = 0; i < balls; i++) {
-        world.addBall(randBall(i));
+        initial.push_back(randBall(i));
     }
+    world.addBalls(initial);
+
+    // physics runs on its own thread so a slow step never drops a frame
+    world.startSimulation();
 
     InitWindow(screenWidth, screenHeight, "balls");
 
     SetTargetFPS(60);
 
+    auto renderer = std::make_unique<WorldRenderer>();
+
+    // wheel zooms around the cursor, dragging with the middle button pans
+    Camera2D camera = {};
+    camera.zoom = 1;
+    auto lastMouse = GetMousePosition();
+
+    // F1 folds the overlay down to the fps and the ball count
+    PerfOverlay overlay;
+    float drawSeconds = 0, presentSeconds = 0;
+
     while (!WindowShouldClose()) {
+        auto screenMouse = GetMousePosition();
+        if (float wheel = GetMouseWheelMove(); wheel != 0) {
+            camera.target = GetScreenToWorld2D(screenMouse, camera);
+            camera.offset = screenMouse;
+            camera.zoom = Clamp(camera.zoom * (1 + wheel * 0.1f), 0.01f, 100.0f);
+        }
+        if (IsMouseButtonDown(MOUSE_MIDDLE_BUTTON)) {
+            camera.target = Vector2Subtract(camera.target,
+                                            Vector2Scale(Vector2Subtract(screenMouse, lastMouse), 1 / camera.zoom));
+        }
+        lastMouse = screenMouse;
+        auto mouse = GetScreenToWorld2D(screenMouse, camera);
+
         bool rPressed = IsMouseButtonDown(MOUSE_RIGHT_BUTTON);
         if (IsMouseButtonDown(MOUSE_LEFT_BUTTON)) {
-            world.setSelected(GetMousePosition(), BallSelectionType::Drag);
+            world.setSelected(mouse, BallSelectionType::Drag);
         }
         if (IsMouseButtonDown(MOUSE_RIGHT_BUTTON)) {
-            world.setSelected(GetMousePosition(), BallSelectionType::Shoot);
+            world.setSelected(mouse, BallSelectionType::Shoot);
         }
         if (IsMouseButtonReleased(MOUSE_LEFT_BUTTON) || IsMouseButtonReleased(MOUSE_RIGHT_BUTTON)) {
             world.unsetSelected();
@@ -46,35 +80,54 @@ int main(void) {
         if (IsKeyPressed(KEY_SPACE)) {
             world.toggleUpdate();
         }
+        if (IsKeyPressed(KEY_G)) {
+            renderer->setGridVisible(!renderer->isGridVisible());
+        }
+        if (IsKeyPressed(KEY_F1)) {
+            overlay.setExpanded(!overlay.isExpanded());
+        }
         if (IsKeyPressed(KEY_A)) {
-            world.addBall(randBall(world.getLastBallId() + 1));
+            world.addBall(randBall(world.getSnapshot().lastId + 1));
         }
         if (IsKeyPressed(KEY_D)) {
-            world.removeBall(world.getLastBallId());
+            world.removeBall(world.getSnapshot().lastId);
         }
 
-        world.update(GetMousePosition(), true);
+        world.update(mouse, true);
+        auto &snapshot = world.getSnapshot();
+        overlay.record(snapshot, drawSeconds, presentSeconds);
 
         BeginDrawing();
+        double drawStart = GetTime();
 
         ClearBackground(BLACK);
 
-        world.draw();
-        DrawText((std::to_string(GetFPS()) + (world.isUpdating() ? "" : "  Paused") +
-                  "\nBalls: " + std::to_string(world.getBallCount()))
-                     .c_str(),
-                 0, 0, 20, WHITE);
-
-        auto selected = world.getSelected();
-        auto type = world.getSelectionType();
-        if (selected != nullptr && type == BallSelectionType::Shoot) {
-            auto mouse = GetMousePosition();
-            DrawLine(mouse.x, mouse.y, selected->pos.x, selected->pos.y, WHITE);
+        // only the part of the world that is on screen gets drawn
+        auto topLeft = GetScreenToWorld2D({0, 0}, camera);
+        auto bottomRight = GetScreenToWorld2D({(float)GetScreenWidth(), (float)GetScreenHeight()}, camera);
+        BeginMode2D(camera);
+        Rectangle view = {topLeft.x, topLeft.y, bottomRight.x - topLeft.x, bottomRight.y - topLeft.y};
+        renderer->draw(world, view, camera.zoom);
+
+        if (snapshot.hasSelected && snapshot.selectionType == BallSelectionType::Shoot) {
+            DrawLineV(mouse, snapshot.selectedPos, WHITE);
         }
+        EndMode2D();
+
+        overlay.draw(0, 0);
 
+        // presenting waits for vsync, so it takes whatever is left of the frame
+        double presentStart = GetTime();
+        drawSeconds = presentStart - drawStart;
         EndDrawing();
+        presentSeconds = GetTime() - presentStart;
     }
 
+    // the renderer's texture has to go before the window does
+    renderer.reset();
+    world.stopSimulation();
     CloseWindow();
     return 0;
-}
\ No newline at end of file
+}
+
+#endif  // BALLS_HEADLESS
\ No newline at end of file
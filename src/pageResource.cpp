@@ -0,0 +1,77 @@
+#include "pageResource.hpp"
+
+#include <cstdint>
+#include <new>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
+
+// size of a huge page on x86-64 and most arm64 systems, mappings are made in whole huge pages
+constexpr size_t HUGE_PAGE = 2 * 1024 * 1024;
+// smallest page there is, pre-faulting touches one byte of each
+constexpr size_t SMALL_PAGE = 4096;
+// allocations below this go to new, a mapping of their own would mostly be padding
+constexpr size_t MIN_MAPPED = HUGE_PAGE / 2;
+
+static size_t roundUp(size_t bytes, size_t to) { return (bytes + to - 1) / to * to; }
+
+PageResource::PageResource(PageSize size) : pageSize(size) {}
+
+PageSize PageResource::getPageSize(void) const { return pageSize; }
+
+#ifndef _WIN32
+static bool isMapped(PageSize pageSize, size_t bytes) {
+    return pageSize == PageSize::Huge && bytes >= MIN_MAPPED;
+}
+
+void *PageResource::do_allocate(size_t bytes, size_t alignment) {
+    if (!isMapped(pageSize, bytes)) return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+
+    size_t size = roundUp(bytes, HUGE_PAGE);
+    void *memory = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    if (memory == MAP_FAILED) {
+        // no huge pages reserved, map a huge page more than needed so the range can start on a huge page
+        // boundary, which transparent huge pages need
+        auto raw = mmap(nullptr, size + HUGE_PAGE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1,
+                        0);
+        if (raw == MAP_FAILED) throw std::bad_alloc();
+        auto start = reinterpret_cast<uintptr_t>(raw);
+        auto aligned = roundUp(start, HUGE_PAGE);
+        if (aligned > start) munmap(raw, aligned - start);
+        munmap(reinterpret_cast<void *>(aligned + size), start + HUGE_PAGE - aligned);
+        memory = reinterpret_cast<void *>(aligned);
+#ifdef MADV_HUGEPAGE
+        madvise(memory, size, MADV_HUGEPAGE);
+#endif
+    }
+
+    auto bytesOf = static_cast<volatile char *>(memory);
+    for (size_t offset = 0; offset < size; offset += SMALL_PAGE) bytesOf[offset] = 0;
+    return memory;
+}
+
+void PageResource::do_deallocate(void *pointer, size_t bytes, size_t alignment) {
+    if (!isMapped(pageSize, bytes)) {
+        std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+        return;
+    }
+    munmap(pointer, roundUp(bytes, HUGE_PAGE));
+}
+#else
+// no mmap, huge pages on Windows need a privilege most accounts do not have
+void *PageResource::do_allocate(size_t bytes, size_t alignment) {
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+}
+
+void PageResource::do_deallocate(void *pointer, size_t bytes, size_t alignment) {
+    std::pmr::new_delete_resource()->deallocate(pointer, bytes, alignment);
+}
+#endif
+
+bool PageResource::do_is_equal(std::pmr::memory_resource const &other) const noexcept {
+    return this == &other;
+}
\ No newline at end of file
@@ -0,0 +1,151 @@
+// drawing needs a window, the headless build has none
+#ifndef BALLS_HEADLESS
+
+#include "perfOverlay.hpp"
+
+#include <stdlib.h>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <new>
+
+// Replacing the global operator new is the only way to also see what the standard library allocates. Every
+// form is replaced, as the aligned ones do not go through the plain one, and the array forms end up here too.
+static std::atomic<uint64_t> allocationCount = 0;
+
+static void *allocate(size_t size) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    return malloc(size > 0 ? size : 1);
+}
+
+static void *allocateAligned(size_t size, std::align_val_t alignment) {
+    allocationCount.fetch_add(1, std::memory_order_relaxed);
+    auto align = (size_t)alignment;
+#ifdef _WIN32
+    return _aligned_malloc(size > 0 ? size : 1, align);
+#else
+    // aligned_alloc wants a whole number of alignments
+    return aligned_alloc(align, std::max(align, (size + align - 1) / align * align));
+#endif
+}
+
+// what allocateAligned hands out has to go back through this
+static void freeAligned(void *p) {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    free(p);
+#endif
+}
+
+void *operator new(size_t size) {
+    if (void *p = allocate(size)) return p;
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+    if (void *p = allocateAligned(size, alignment)) return p;
+    throw std::bad_alloc();
+}
+
+void *operator new(size_t size, std::nothrow_t const &) noexcept { return allocate(size); }
+
+void *operator new(size_t size, std::align_val_t alignment, std::nothrow_t const &) noexcept {
+    return allocateAligned(size, alignment);
+}
+
+void operator delete(void *p) noexcept { free(p); }
+
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+void operator delete(void *p, std::nothrow_t const &) noexcept { free(p); }
+
+void operator delete(void *p, std::align_val_t) noexcept { freeAligned(p); }
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept { freeAligned(p); }
+
+void operator delete(void *p, std::align_val_t, std::nothrow_t const &) noexcept { freeAligned(p); }
+
+uint64_t getAllocationCount(void) { return allocationCount.load(std::memory_order_relaxed); }
+
+static char const *const PHASE_NAMES[PerfOverlay::PHASES] = {"integrate", "buildCells", "collide", "draw",
+                                                             "present"};
+static Color const PHASE_COLORS[PerfOverlay::PHASES] = {SKYBLUE, ORANGE, RED, GREEN, VIOLET};
+
+// a sample takes this many pixels across the graph
+constexpr int COLUMN = 2;
+constexpr int GRAPH_HEIGHT = 120;
+// time at the top of the graph, a 60 fps frame is half way up
+constexpr float GRAPH_SECONDS = 2 / 60.0f;
+// the legend shows the average of this many frames, the latest alone jumps around too much to read
+constexpr size_t AVERAGE = 30;
+constexpr int FONT = 20;
+
+void PerfOverlay::record(WorldSnapshot const &snapshot, float drawSeconds, float presentSeconds) {
+    auto &stats = snapshot.stats;
+    phases[Integrate].push(stats.integrate);
+    phases[BuildCells].push(stats.buildCells);
+    phases[Collide].push(stats.collide);
+    phases[Draw].push(drawSeconds);
+    phases[Present].push(presentSeconds);
+    pairsTested.push(stats.pairsTested);
+    contacts.push(stats.contacts);
+    memory.push(stats.memory);
+
+    auto count = getAllocationCount();
+    allocations.push(count - allocationsBefore);
+    allocationsBefore = count;
+    ballCount = snapshot.ballCount;
+    updating = snapshot.updating;
+}
+
+void PerfOverlay::draw(int x, int y) const {
+    DrawText(TextFormat("%d%s\nBalls: %d", GetFPS(), updating ? "" : "  Paused", ballCount), x, y, FONT, WHITE);
+    if (!expanded || pairsTested.size() == 0) return;
+
+    y += 2 * FONT + 10;
+    DrawText(TextFormat("pairs tested: %llu (peak %llu)", (unsigned long long)pairsTested.back(),
+                        (unsigned long long)pairsTested.max()),
+             x, y, FONT, WHITE);
+    DrawText(TextFormat("contacts: %llu (peak %llu)", (unsigned long long)contacts.back(),
+                        (unsigned long long)contacts.max()),
+             x, y + FONT, FONT, WHITE);
+    DrawText(TextFormat("allocations: %llu a frame (peak %llu)", (unsigned long long)allocations.back(),
+                        (unsigned long long)allocations.max()),
+             x, y + 2 * FONT, FONT, WHITE);
+    DrawText(TextFormat("memory: %.1f MB", memory.back() / (1024.0 * 1024.0)), x, y + 3 * FONT, FONT, WHITE);
+
+    y += 4 * FONT + 10;
+    int width = HISTORY * COLUMN;
+    DrawRectangle(x, y, width, GRAPH_HEIGHT, Fade(BLACK, 0.7f));
+    auto height = [](float seconds) { return std::min(seconds / GRAPH_SECONDS, 1.0f) * GRAPH_HEIGHT; };
+    int budget = y + GRAPH_HEIGHT - height(1 / 60.0f);
+    DrawLine(x, budget, x + width, budget, DARKGRAY);
+
+    for (int phase = 0; phase < PHASES; phase++) {
+        auto &samples = phases[phase];
+        // the newest sample sits on the right edge
+        int first = x + (HISTORY - samples.size()) * COLUMN;
+        for (size_t i = 1; i < samples.size(); i++) {
+            DrawLine(first + (i - 1) * COLUMN, y + GRAPH_HEIGHT - height(samples[i - 1]), first + i * COLUMN,
+                     y + GRAPH_HEIGHT - height(samples[i]), PHASE_COLORS[phase]);
+        }
+
+        size_t averaged = std::min(AVERAGE, samples.size());
+        float sum = 0;
+        for (size_t i = samples.size() - averaged; i < samples.size(); i++) sum += samples[i];
+        int legend = y + phase * (FONT + 4);
+        DrawRectangle(x + width + 8, legend + 4, FONT - 8, FONT - 8, PHASE_COLORS[phase]);
+        DrawText(TextFormat("%s %.2f ms", PHASE_NAMES[phase], sum / averaged * 1000), x + width + FONT + 4,
+                 legend, FONT, WHITE);
+    }
+}
+
+void PerfOverlay::setExpanded(bool e) { expanded = e; }
+
+bool PerfOverlay::isExpanded(void) const { return expanded; }
+
+#endif  // BALLS_HEADLESS
\ No newline at end of file
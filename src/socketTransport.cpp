@@ -0,0 +1,148 @@
+#ifndef _WIN32
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "transport.hpp"
+
+// every message goes out as its size followed by its bytes
+using MessageSize = uint64_t;
+
+static std::runtime_error socketError(char const *what) {
+    return std::runtime_error(std::string(what) + ": " + std::strerror(errno));
+}
+
+std::unique_ptr<SocketTransport> SocketTransport::forkLocal(int processCount) {
+    if (processCount < 1) throw std::invalid_argument("need at least one process");
+    // pairs[a][b] is the end of the a-b socket pair that rank a keeps
+    std::vector<std::vector<int>> pairs(processCount, std::vector<int>(processCount, -1));
+    for (int a = 0; a < processCount; a++) {
+        for (int b = a + 1; b < processCount; b++) {
+            int fds[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) throw socketError("socketpair");
+            pairs[a][b] = fds[0];
+            pairs[b][a] = fds[1];
+        }
+    }
+
+    int rank = 0;
+    std::vector<int> children;
+    for (int r = 1; r < processCount; r++) {
+        auto pid = fork();
+        if (pid < 0) throw socketError("fork");
+        if (pid == 0) {
+            rank = r;
+            children.clear();
+            break;
+        }
+        children.push_back(pid);
+    }
+
+    // keep this rank's ends and close everything else
+    for (int a = 0; a < processCount; a++) {
+        for (int b = 0; b < processCount; b++) {
+            if (a != rank && pairs[a][b] != -1) close(pairs[a][b]);
+        }
+    }
+    for (auto fd : pairs[rank]) {
+        if (fd != -1) fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+    return std::unique_ptr<SocketTransport>(new SocketTransport(rank, pairs[rank], children));
+}
+
+SocketTransport::SocketTransport(int r, std::vector<int> s, std::vector<int> c)
+    : rank(r), sockets(std::move(s)), children(std::move(c)) {}
+
+SocketTransport::~SocketTransport() {
+    for (auto fd : sockets) {
+        if (fd != -1) close(fd);
+    }
+    for (auto pid : children) waitpid(pid, nullptr, 0);
+}
+
+int SocketTransport::getRank(void) const { return rank; }
+
+int SocketTransport::getSize(void) const { return sockets.size(); }
+
+void SocketTransport::exchange(std::vector<Exchange> &exchanges) {
+    // how far along each exchange is, the size header counts as the first bytes of the message
+    struct Progress {
+        MessageSize outSize;
+        size_t sent;
+        MessageSize inSize;
+        size_t received;
+    };
+    constexpr size_t HEADER = sizeof(MessageSize);
+    std::vector<Progress> progress(exchanges.size());
+    std::vector<pollfd> polls(exchanges.size());
+    for (size_t i = 0; i < exchanges.size(); i++) {
+        auto peer = exchanges[i].peer;
+        if (peer < 0 || peer >= getSize() || peer == rank) throw std::invalid_argument("invalid peer");
+        progress[i] = {exchanges[i].out.size(), 0, 0, 0};
+        exchanges[i].in.clear();
+    }
+
+    auto done = [&](size_t i) {
+        auto &p = progress[i];
+        return p.sent == HEADER + p.outSize && p.received >= HEADER && p.received == HEADER + p.inSize;
+    };
+
+    while (true) {
+        size_t active = 0;
+        for (size_t i = 0; i < exchanges.size(); i++) {
+            if (done(i)) continue;
+            auto &p = progress[i];
+            short events = 0;
+            if (p.sent < HEADER + p.outSize) events |= POLLOUT;
+            if (p.received < HEADER || p.received < HEADER + p.inSize) events |= POLLIN;
+            polls[active++] = {sockets[exchanges[i].peer], events, 0};
+        }
+        if (active == 0) return;
+        if (poll(polls.data(), active, -1) < 0) {
+            if (errno == EINTR) continue;
+            throw socketError("poll");
+        }
+
+        for (size_t i = 0, slot = 0; i < exchanges.size(); i++) {
+            if (done(i)) continue;
+            auto &pfd = polls[slot++];
+            auto &p = progress[i];
+            auto &e = exchanges[i];
+            if (pfd.revents & POLLOUT) {
+                ssize_t n;
+                if (p.sent < HEADER) {
+                    n = send(pfd.fd, (char *)&p.outSize + p.sent, HEADER - p.sent, MSG_NOSIGNAL);
+                } else {
+                    n = send(pfd.fd, e.out.data() + p.sent - HEADER, HEADER + p.outSize - p.sent, MSG_NOSIGNAL);
+                }
+                if (n < 0 && errno != EAGAIN && errno != EINTR) throw socketError("send");
+                if (n > 0) p.sent += n;
+            }
+            if (pfd.revents & (POLLIN | POLLHUP | POLLERR)) {
+                ssize_t n;
+                if (p.received < HEADER) {
+                    n = recv(pfd.fd, (char *)&p.inSize + p.received, HEADER - p.received, 0);
+                } else {
+                    n = recv(pfd.fd, e.in.data() + p.received - HEADER, HEADER + p.inSize - p.received, 0);
+                }
+                if (n == 0) throw std::runtime_error("peer " + std::to_string(e.peer) + " hung up");
+                if (n < 0 && errno != EAGAIN && errno != EINTR) throw socketError("recv");
+                if (n > 0) {
+                    p.received += n;
+                    if (p.received == HEADER) e.in.resize(p.inSize);
+                }
+            }
+        }
+    }
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,202 @@
+#include "softwareRenderer.hpp"
+
+#include <math.h>
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define BALLS_X86
+#endif
+
+// side of a tile in pixels, its three planes come to 48KB and stay in the cache while its balls go in
+constexpr int TILE = 64;
+// floats in a plane, with room for 8 lanes that run past the end of its last row. Those lanes are masked out
+// but still loaded and stored.
+constexpr int PLANE = TILE * TILE + 8;
+
+// Blends a circle into the pixels [x0, x1) x [y0, y1) of a tile. A pixel is covered by how far its centre is
+// inside the edge plus half a pixel, clamped to [0, 1], which is close to the area it covers for anything but
+// the tiniest circles.
+using CircleKernel = void (*)(float *planes, int x0, int x1, int y0, int y1, float cx, float cy, float radius,
+                              Color color);
+
+static void fillCircleScalar(float *planes, int x0, int x1, int y0, int y1, float cx, float cy, float radius,
+                             Color color) {
+    float alpha = color.a / 255.0f;
+    float edge = radius + 0.5f;
+    for (int y = y0; y < y1; y++) {
+        float dy = y + 0.5f - cy;
+        for (int x = x0; x < x1; x++) {
+            float dx = x + 0.5f - cx;
+            float coverage = std::clamp(edge - sqrtf(dx * dx + dy * dy), 0.0f, 1.0f) * alpha;
+            int i = y * TILE + x;
+            planes[i] += (color.r - planes[i]) * coverage;
+            planes[PLANE + i] += (color.g - planes[PLANE + i]) * coverage;
+            planes[2 * PLANE + i] += (color.b - planes[2 * PLANE + i]) * coverage;
+        }
+    }
+}
+
+#ifdef BALLS_X86
+// the same sums as the scalar loop in the same order, so both give the same pixels
+__attribute__((target("avx2"))) static void fillCircleAvx2(float *planes, int x0, int x1, int y0, int y1, float cx,
+                                                           float cy, float radius, Color color) {
+    const __m256 centres = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f);
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1);
+    const __m256 alpha = _mm256_set1_ps(color.a / 255.0f);
+    const __m256 edge = _mm256_set1_ps(radius + 0.5f);
+    const __m256 centreX = _mm256_set1_ps(cx);
+    const __m256 channels[3] = {_mm256_set1_ps(color.r), _mm256_set1_ps(color.g), _mm256_set1_ps(color.b)};
+
+    for (int y = y0; y < y1; y++) {
+        float dy = y + 0.5f - cy;
+        __m256 dy2 = _mm256_set1_ps(dy * dy);
+        for (int x = x0; x < x1; x += 8) {
+            __m256 dx = _mm256_sub_ps(_mm256_add_ps(_mm256_set1_ps((float)x), centres), centreX);
+            __m256 distance = _mm256_sqrt_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), dy2));
+            __m256 coverage = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(edge, distance), zero), one);
+            // lanes past x1 blend with nothing, which leaves whatever they loaded as it was
+            __m256 inside = _mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_set1_epi32(x1 - x), lanes));
+            coverage = _mm256_and_ps(_mm256_mul_ps(coverage, alpha), inside);
+            for (int channel = 0; channel < 3; channel++) {
+                float *p = planes + channel * PLANE + y * TILE + x;
+                __m256 v = _mm256_loadu_ps(p);
+                __m256 towards = _mm256_mul_ps(_mm256_sub_ps(channels[channel], v), coverage);
+                _mm256_storeu_ps(p, _mm256_add_ps(v, towards));
+            }
+        }
+    }
+}
+#endif  // BALLS_X86
+
+static CircleKernel selectKernel(void) {
+#ifdef BALLS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return fillCircleAvx2;
+#endif
+    return fillCircleScalar;
+}
+
+SoftwareRenderer::SoftwareRenderer(int w, int h, unsigned threadCount)
+    : width(w), height(h), gridVisible(true), pool(threadCount), origin{0, 0}, scale(1) {
+    if (w <= 0 || h <= 0) throw std::invalid_argument("image size has to be positive");
+    pixels.resize((size_t)w * h * 3);
+    // the calling thread works on tiles too and gets the last slot
+    tiles.resize((pool.getThreadCount() + 1) * 3 * PLANE);
+}
+
+void SoftwareRenderer::setGridVisible(bool visible) { gridVisible = visible; }
+
+bool SoftwareRenderer::isGridVisible(void) const { return gridVisible; }
+
+int SoftwareRenderer::getWidth(void) const { return width; }
+
+int SoftwareRenderer::getHeight(void) const { return height; }
+
+uint8_t const *SoftwareRenderer::getPixels(void) const { return pixels.data(); }
+
+void SoftwareRenderer::draw(CollidingWorld const &world) {
+    auto [wx, wy] = world.getWorldConstraint();
+    draw(world, {0, 0, (float)wx, (float)wy});
+}
+
+void SoftwareRenderer::draw(CollidingWorld const &world, Rectangle view) {
+    scale = std::min(width / view.width, height / view.height);
+    // whatever the view leaves over in the image is split evenly between both sides
+    origin = {view.x - (width / scale - view.width) / 2, view.y - (height / scale - view.height) / 2};
+    size_t columns = (width + TILE - 1) / TILE, rows = (height + TILE - 1) / TILE;
+    pool.parallelFor(columns * rows, 1, [&](size_t begin, size_t end) {
+        float *planes = tiles.data() + pool.getCurrentSlot() * 3 * PLANE;
+        for (size_t tile = begin; tile < end; tile++) drawTile(world, tile, planes);
+    });
+}
+
+void SoftwareRenderer::drawTile(CollidingWorld const &world, size_t tile, float *planes) {
+    static const CircleKernel fillCircle = selectKernel();
+
+    size_t columns = (width + TILE - 1) / TILE;
+    int left = tile % columns * TILE, top = tile / columns * TILE;
+    int tileWidth = std::min(TILE, width - left), tileHeight = std::min(TILE, height - top);
+    // the part of the world the tile shows
+    float x0 = origin.x + left / scale, y0 = origin.y + top / scale;
+    float x1 = origin.x + (left + tileWidth) / scale, y1 = origin.y + (top + tileHeight) / scale;
+    std::fill(planes, planes + 3 * PLANE, 0.0f);
+
+    auto &snapshot = world.getSnapshot();
+    auto cellSize = world.getCellSize();
+    auto [wx, wy] = world.getWorldConstraint();
+
+    if (gridVisible) {
+        // the lines CollidingWorld::draw draws, a pixel wide at any scale
+        auto pixel = [&](float coord, float from) { return (int)floorf((coord - from) * scale); };
+        auto line = [&](int x, int y) {
+            planes[y * TILE + x] = GRAY.r;
+            planes[PLANE + y * TILE + x] = GRAY.g;
+            planes[2 * PLANE + y * TILE + x] = GRAY.b;
+        };
+        int firstY = std::clamp(pixel(0, origin.y) - top, 0, tileHeight);
+        int lastY = std::clamp(pixel(wy, origin.y) - top, 0, tileHeight);
+        int lastColumn = std::min(wx / cellSize - 1, (int)floorf(x1 / cellSize));
+        for (int i = std::max(0, (int)floorf(x0 / cellSize)); i <= lastColumn; i++) {
+            int x = pixel(i * cellSize, origin.x) - left;
+            if (x < 0 || x >= tileWidth) continue;
+            for (int y = firstY; y < lastY; y++) line(x, y);
+        }
+        int firstX = std::clamp(pixel(0, origin.x) - left, 0, tileWidth);
+        int lastX = std::clamp(pixel(wx, origin.x) - left, 0, tileWidth);
+        int lastRow = std::min(wy / cellSize - 1, (int)floorf(y1 / cellSize));
+        for (int j = std::max(0, (int)floorf(y0 / cellSize)); j <= lastRow; j++) {
+            int y = pixel(j * cellSize, origin.y) - top;
+            if (y < 0 || y >= tileHeight) continue;
+            for (int x = firstX; x < lastX; x++) line(x, y);
+        }
+    }
+
+    auto &sprites = snapshot.sprites;
+    auto blend = [&](BallSprite const &sprite) {
+        float cx = (sprite.pos.x - origin.x) * scale - left, cy = (sprite.pos.y - origin.y) * scale - top;
+        float radius = sprite.radius * scale;
+        // the pixels whose centre is within half a pixel of the circle, clamped as floats so far off balls
+        // do not overflow an int
+        int bx0 = std::clamp(floorf(cx - radius - 1), 0.0f, (float)tileWidth);
+        int bx1 = std::clamp(ceilf(cx + radius + 1), 0.0f, (float)tileWidth);
+        int by0 = std::clamp(floorf(cy - radius - 1), 0.0f, (float)tileHeight);
+        int by1 = std::clamp(ceilf(cy + radius + 1), 0.0f, (float)tileHeight);
+        if (bx0 < bx1 && by0 < by1) fillCircle(planes, bx0, bx1, by0, by1, cx, cy, radius, sprite.color);
+    };
+    world.forEachSpriteRange({x0, y0, x1 - x0, y1 - y0}, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) blend(sprites[i]);
+    });
+    // balls outside the grid go last, as they do in the snapshot
+    if (!snapshot.cellStart.empty()) {
+        for (size_t i = snapshot.cellStart.back(); i < sprites.size(); i++) blend(sprites[i]);
+    }
+
+    for (int y = 0; y < tileHeight; y++) {
+        auto out = pixels.data() + ((size_t)(top + y) * width + left) * 3;
+        for (int x = 0; x < tileWidth; x++) {
+            for (int channel = 0; channel < 3; channel++) {
+                out[x * 3 + channel] = (uint8_t)(planes[channel * PLANE + y * TILE + x] + 0.5f);
+            }
+        }
+    }
+}
+
+void SoftwareRenderer::writePpm(std::ostream &out) const {
+    out << "P6\n" << width << " " << height << "\n255\n";
+    writeRaw(out);
+}
+
+void SoftwareRenderer::savePpm(std::string const &path) const {
+    std::ofstream file(path, std::ios::binary);
+    if (file) writePpm(file);
+    if (!file) throw std::runtime_error("could not write " + path);
+}
+
+void SoftwareRenderer::writeRaw(std::ostream &out) const {
+    out.write(reinterpret_cast<char const *>(pixels.data()), pixels.size());
+}
\ No newline at end of file
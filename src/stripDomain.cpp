@@ -0,0 +1,116 @@
+#include "stripDomain.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+// balls travel between processes as their raw bytes
+static_assert(std::is_trivially_copyable_v<Ball>);
+
+// Top of the given rank's strip. Strips are whole cell rows, so a strip's halo is exactly the row of cells
+// next to it.
+static float stripEdge(int rank, int size, int cellSize, Vec2<int> worldConstraint) {
+    int rows = worldConstraint.y / cellSize + 1;
+    return (float)(rank * rows / size * cellSize);
+}
+
+// the strip's rows and the halo rows above and below, the outer strips have nothing past the world's edge
+static WorldOptions stripOptions(int rank, int size, int cellSize, Vec2<int> worldConstraint, unsigned threadCount) {
+    int first = (int)stripEdge(rank, size, cellSize, worldConstraint) / cellSize;
+    int last = (int)stripEdge(rank + 1, size, cellSize, worldConstraint) / cellSize;
+    return WorldOptions{.threadCount = threadCount, .firstRow = std::max(0, first - 1), .gridRows = last - first + 2};
+}
+
+StripDomain::StripDomain(Transport &t, int c, Vec2<int> worldConstraint, unsigned threadCount)
+    : transport(t),
+      cellSize(c),
+      rank(t.getRank()),
+      size(t.getSize()),
+      top(stripEdge(rank, size, c, worldConstraint)),
+      bottom(stripEdge(rank + 1, size, c, worldConstraint)),
+      world(c, worldConstraint, stripOptions(rank, size, c, worldConstraint, threadCount)),
+      owned(0),
+      added(0) {}
+
+CollidingWorld &StripDomain::getWorld(void) { return world; }
+
+int StripDomain::getOwnedCount(void) const { return owned + added; }
+
+float StripDomain::getTop(void) const { return top; }
+
+float StripDomain::getBottom(void) const { return bottom; }
+
+bool StripDomain::owns(Vector2 pos) const {
+    // the outer strips own everything past their edge too
+    return (rank == 0 || pos.y >= top) && (rank == size - 1 || pos.y < bottom);
+}
+
+void StripDomain::addBall(Ball const &ball) {
+    if (!owns(ball.pos)) return;
+    world.addBall(ball);
+    added++;
+}
+
+std::vector<Ball> StripDomain::swap(std::vector<Ball> const &up, std::vector<Ball> const &down) {
+    auto pack = [](std::vector<Ball> const &balls) {
+        std::vector<char> bytes(balls.size() * sizeof(Ball));
+        if (!balls.empty()) std::memcpy(bytes.data(), balls.data(), bytes.size());
+        return bytes;
+    };
+    exchanges.clear();
+    if (rank > 0) exchanges.push_back({rank - 1, pack(up), {}});
+    if (rank < size - 1) exchanges.push_back({rank + 1, pack(down), {}});
+    transport.exchange(exchanges);
+
+    std::vector<Ball> received;
+    for (auto &e : exchanges) {
+        for (size_t offset = 0; offset + sizeof(Ball) <= e.in.size(); offset += sizeof(Ball)) {
+            Ball ball(0, 0, 0, {}, {}, {}, {});
+            std::memcpy(&ball, e.in.data() + offset, sizeof(Ball));
+            received.push_back(ball);
+        }
+    }
+    return received;
+}
+
+void StripDomain::step(float dt, bool checkCollision) {
+    std::vector<Ball> up, down, haloUp, haloDown;
+    // owned balls within a cell of the edge are sent to the neighbour as ghosts
+    auto halo = [&](Ball const &ball) {
+        if (rank > 0 && ball.pos.y < top + cellSize) haloUp.push_back(ball);
+        if (rank < size - 1 && ball.pos.y >= bottom - cellSize) haloDown.push_back(ball);
+    };
+
+    int kept = 0;
+    for (int i = 0; i < world.getBallCount(); i++) {
+        auto ball = world.getBallAt(i);
+        if (ghosts.count(ball.id)) continue;
+        if (owns(ball.pos)) {
+            kept++;
+            halo(ball);
+            continue;
+        }
+        (ball.pos.y < top ? up : down).push_back(ball);
+    }
+    // the ghosts go first, a ball that comes over might still have a ghost here
+    std::vector<int> gone(ghosts.begin(), ghosts.end());
+    for (auto &ball : up) gone.push_back(ball.id);
+    for (auto &ball : down) gone.push_back(ball.id);
+    world.removeBalls(gone);
+    ghosts.clear();
+
+    auto arrived = swap(up, down);
+    for (auto &ball : arrived) halo(ball);
+    world.addBalls(arrived);
+    owned = kept + arrived.size() + added;
+    added = 0;
+
+    auto ghostBalls = swap(haloUp, haloDown);
+    for (auto &ball : ghostBalls) {
+        ball.shouldUpdate = false;
+        ghosts.insert(ball.id);
+    }
+    world.addBalls(ghostBalls);
+
+    world.update(Vector2Zero(), checkCollision, dt);
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+#include "taskGraph.hpp"
+
+TaskGraph::TaskGraph(void) : pendingSize(0), pool(nullptr), job(nullptr) {}
+
+void TaskGraph::depend(Node node, Node on) {
+    nodes[on].successors.push_back(node);
+    nodes[node].dependencies++;
+}
+
+size_t TaskGraph::getNodeCount(void) const { return nodes.size(); }
+
+void TaskGraph::runNodes(void *ctx, size_t begin, size_t end) {
+    auto graph = static_cast<TaskGraph *>(ctx);
+    for (auto i = begin; i < end; i++) {
+        auto &node = graph->nodes[i];
+        node.fn();
+        for (auto successor : node.successors) {
+            if (graph->pending[successor].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                graph->pool->spawn(graph->job, successor);
+            }
+        }
+    }
+}
+
+void TaskGraph::prepare(void) {
+    if (pendingSize != nodes.size()) {
+        pending = std::make_unique<std::atomic<unsigned>[]>(nodes.size());
+        pendingSize = nodes.size();
+    }
+}
+
+void TaskGraph::run(ThreadPool &p) {
+    if (nodes.empty()) return;
+    prepare();
+    for (size_t i = 0; i < nodes.size(); i++) pending[i].store(nodes[i].dependencies, std::memory_order_relaxed);
+
+    ThreadPool::Caller caller(p);
+    ThreadPool::Job current = {runNodes, this, 1, {nodes.size()}, false, p.runningJob()};
+    pool = &p;
+    job = &current;
+    for (size_t i = 0; i < nodes.size(); i++) {
+        if (nodes[i].dependencies == 0) p.spawn(&current, i);
+    }
+    p.wait(current);
+    pool = nullptr;
+    job = nullptr;
+}
@@ -0,0 +1,213 @@
+#include "threadPool.hpp"
+
+#include <algorithm>
+#include <utility>
+
+// the pool and deque slot of the current thread, so nested parallelFor calls reuse the caller's deque
+static thread_local ThreadPool const *currentPool = nullptr;
+static thread_local unsigned currentSlot = 0;
+// the job of the task the current thread is running for currentPool, a ThreadPool::Job which is private
+static thread_local void *currentJob = nullptr;
+
+// idle rounds a worker spins through before going to sleep, jobs often come in quick bursts
+constexpr int IDLE_SPINS = 64;
+
+bool ThreadPool::Deque::push(Task task) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tail - head == CAPACITY) return false;
+    tasks[tail++ % CAPACITY] = task;
+    return true;
+}
+
+bool ThreadPool::Deque::pop(Task &task, Job const *group) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tail == head) return false;
+    if (group != nullptr && !inGroup(tasks[(tail - 1) % CAPACITY].job, group)) return false;
+    task = tasks[--tail % CAPACITY];
+    return true;
+}
+
+bool ThreadPool::Deque::steal(Task &task, Job const *group) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (tail == head) return false;
+    if (group != nullptr && !inGroup(tasks[head % CAPACITY].job, group)) return false;
+    task = tasks[head++ % CAPACITY];
+    return true;
+}
+
+ThreadPool::ThreadPool(unsigned count)
+    : threadCount(count != 0 ? count : std::max(1u, std::thread::hardware_concurrency())),
+      queued(0),
+      sleeping(0),
+      stopping(false) {
+    deques = std::make_unique<Deque[]>(threadCount);
+    workers.reserve(threadCount - 1);
+    for (unsigned slot = 1; slot < threadCount; slot++) {
+        workers.emplace_back([this, slot]() { workerLoop(slot); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto &worker : workers) worker.join();
+}
+
+unsigned ThreadPool::getThreadCount(void) const { return threadCount; }
+
+unsigned ThreadPool::getCurrentSlot(void) const { return currentPool == this ? currentSlot : threadCount; }
+
+void ThreadPool::signal(void) {
+    queued.fetch_add(1);
+    if (sleeping.load() > 0) {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wake.notify_one();
+    }
+}
+
+ThreadPool::Job *ThreadPool::runningJob(void) const {
+    return currentPool == this ? static_cast<Job *>(currentJob) : nullptr;
+}
+
+bool ThreadPool::inGroup(Job const *job, Job const *group) {
+    // a job waits for the jobs its tasks start, so the chain of parents is still alive
+    for (; job != nullptr; job = job->parent) {
+        if (job == group) return true;
+    }
+    return false;
+}
+
+bool ThreadPool::findTask(unsigned slot, Task &task, Job const *group) {
+    // The calling thread's own deque only has tasks of the group on top while it waits, as anything it pushed
+    // since the group started came from the group. The other deques may have anything at their head.
+    bool found = deques[slot].pop(task, group);
+    for (unsigned i = 1; !found && i < threadCount; i++) {
+        found = deques[(slot + i) % threadCount].steal(task, group);
+    }
+    if (!found && group == nullptr) found = inbox.steal(task);
+    if (found) queued.fetch_sub(1);
+    return found;
+}
+
+void ThreadPool::execute(unsigned slot, Task task) {
+    auto job = task.job;
+    auto begin = task.begin, end = task.end;
+    auto previousJob = std::exchange(currentJob, job);
+    if (job->posted) {
+        job->fn(job->ctx, begin, end);
+        currentJob = previousJob;
+        return;
+    }
+
+    // hand the upper half to whoever wants it and keep going with the lower half
+    while (end - begin > job->grain) {
+        size_t chunks = (end - begin + job->grain - 1) / job->grain;
+        size_t mid = begin + chunks / 2 * job->grain;
+        if (!deques[slot].push({job, mid, end})) break;
+        signal();
+        end = mid;
+    }
+
+    for (auto b = begin; b < end; b += job->grain) {
+        job->fn(job->ctx, b, std::min(end, b + job->grain));
+    }
+    currentJob = previousJob;
+    job->remaining.fetch_sub(end - begin, std::memory_order_release);
+}
+
+ThreadPool::Caller::Caller(ThreadPool &pool)
+    : previousPool(currentPool),
+      previousSlot(currentSlot),
+      previousJob(static_cast<Job *>(currentJob)),
+      lock(pool.callerMutex, std::defer_lock) {
+    if (currentPool != &pool) {
+        lock.lock();
+        currentPool = &pool;
+        currentSlot = 0;
+        currentJob = nullptr;
+    }
+}
+
+ThreadPool::Caller::~Caller() {
+    currentPool = previousPool;
+    currentSlot = previousSlot;
+    currentJob = previousJob;
+}
+
+void ThreadPool::run(size_t count, size_t grain, ChunkFn fn, void *ctx) {
+    if (count == 0) return;
+    grain = std::max<size_t>(grain, 1);
+    if (threadCount == 1 || count <= grain) {
+        for (size_t b = 0; b < count; b += grain) fn(ctx, b, std::min(count, b + grain));
+        return;
+    }
+
+    Caller caller(*this);
+    Job job = {fn, ctx, grain, {count}, false, runningJob()};
+    execute(currentSlot, {&job, 0, count});
+    wait(job);
+}
+
+void ThreadPool::spawn(Job *job, size_t item) {
+    if (deques[currentSlot].push({job, item, item + 1})) {
+        signal();
+    } else {
+        execute(currentSlot, {job, item, item + 1});
+    }
+}
+
+ThreadPool::Posted::Posted(void (*f)(void *), void *c) : fn(f), ctx(c), job{runPosted, this, 1, {1}, true, nullptr} {}
+
+void ThreadPool::runPosted(void *ctx, size_t, size_t) {
+    auto posted = static_cast<Posted *>(ctx);
+    posted->fn(posted->ctx);
+}
+
+void ThreadPool::post(Posted &work) {
+    if (threadCount == 1 || !inbox.push({&work.job, 0, 1})) {
+        work.fn(work.ctx);
+        return;
+    }
+    signal();
+}
+
+void ThreadPool::wait(Job &job) {
+    // Help out until the last item is finished. Only tasks of job and of the jobs they started are run here,
+    // anything else could be a lot of unrelated work to sit through before getting back to the caller.
+    while (job.remaining.load(std::memory_order_acquire) != 0) {
+        Task task;
+        if (findTask(currentSlot, task, &job)) {
+            execute(currentSlot, task);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+void ThreadPool::workerLoop(unsigned slot) {
+    currentPool = this;
+    currentSlot = slot;
+    int idle = 0;
+    while (true) {
+        Task task;
+        if (findTask(slot, task, nullptr)) {
+            execute(slot, task);
+            idle = 0;
+            continue;
+        }
+        if (++idle < IDLE_SPINS) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        sleeping.fetch_add(1);
+        wake.wait(lock, [this]() { return stopping || queued.load() > 0; });
+        sleeping.fetch_sub(1);
+        if (stopping) return;
+        idle = 0;
+    }
+}
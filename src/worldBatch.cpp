@@ -0,0 +1,39 @@
+#include "worldBatch.hpp"
+
+#include <algorithm>
+
+WorldBatch::WorldBatch(unsigned threadCount) : pool(threadCount) {}
+
+// commands a batch world can queue before the caller applies them itself, small worlds get few at a time
+constexpr size_t BATCH_COMMAND_CAPACITY = 256;
+
+CollidingWorld &WorldBatch::addWorld(int cellSize, Vec2<int> worldConstraint) {
+    // The worlds step on the batch's pool rather than one each, so a world only costs its balls and cells.
+    // Nobody draws them, so they skip the snapshots too.
+    WorldOptions options;
+    options.commandCapacity = BATCH_COMMAND_CAPACITY;
+    options.pool = &pool;
+    options.publishSnapshots = false;
+    worlds.push_back(std::make_unique<CollidingWorld>(cellSize, worldConstraint, options));
+    order.push_back(worlds.size() - 1);
+    return *worlds.back();
+}
+
+CollidingWorld &WorldBatch::getWorld(size_t index) { return *worlds[index]; }
+
+size_t WorldBatch::getWorldCount(void) const { return worlds.size(); }
+
+unsigned WorldBatch::getThreadCount(void) const { return pool.getThreadCount(); }
+
+void WorldBatch::step(float dt, bool checkCollision) {
+    // a step costs about as much as the world has balls and every thread works through its part of the range
+    // front to back, so starting with the big worlds leaves the small ones to even out the end. Ties go by the
+    // order the worlds were added in, which std::sort gets to without the buffer std::stable_sort allocates.
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        int countA = worlds[a]->getBallCount(), countB = worlds[b]->getBallCount();
+        return countA != countB ? countA > countB : a < b;
+    });
+    pool.parallelFor(order.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) worlds[order[i]]->update(Vector2Zero(), checkCollision, dt);
+    });
+}
\ No newline at end of file
@@ -0,0 +1,193 @@
+// drawing needs a window, the headless build has none
+#ifndef BALLS_HEADLESS
+
+#include "worldRenderer.hpp"
+
+#include <math.h>
+
+#include <algorithm>
+#include <vector>
+
+// side of the circle texture in pixels, mipmaps take care of the many balls drawn smaller than that
+constexpr int CIRCLE_TEXTURE = 64;
+// radius of the circle in the texture, a pixel short of its edge so filtering never bleeds past the quad
+constexpr float CIRCLE_RADIUS = CIRCLE_TEXTURE / 2 - 1;
+// balls with a radius under this many pixels on screen are drawn as a single pixel
+constexpr float POINT_RADIUS = 1;
+// cells narrower than this many pixels on screen are drawn as a heatmap instead of their balls
+constexpr float HEATMAP_CELL = 2;
+// pixels a texel of the heatmap takes on screen at least, smaller cells are summed into one
+constexpr float HEATMAP_TEXEL = 4;
+// Largest world side the grid is drawn into a texture for. Every GL 3.3 gpu takes textures this big, and it
+// keeps the texture at 64MB. raylib hands back a framebuffer even when the texture behind it could not be
+// made, so the size has to be checked before asking rather than after.
+constexpr int GRID_TEXTURE_MAX = 4096;
+
+WorldRenderer::WorldRenderer(void) : grid{}, heatmap{}, gridCellSize(0), gridSize{0, 0}, gridVisible(true) {
+    // white with the coverage of every pixel as alpha, so the edge is smooth once tinted and filtered
+    std::vector<Color> pixels(CIRCLE_TEXTURE * CIRCLE_TEXTURE);
+    for (int y = 0; y < CIRCLE_TEXTURE; y++) {
+        for (int x = 0; x < CIRCLE_TEXTURE; x++) {
+            float dx = x + 0.5f - CIRCLE_TEXTURE / 2.0f, dy = y + 0.5f - CIRCLE_TEXTURE / 2.0f;
+            float coverage = std::clamp(CIRCLE_RADIUS - sqrtf(dx * dx + dy * dy) + 0.5f, 0.0f, 1.0f);
+            pixels[y * CIRCLE_TEXTURE + x] = {255, 255, 255, (unsigned char)(coverage * 255)};
+        }
+    }
+    Image image = {pixels.data(), CIRCLE_TEXTURE, CIRCLE_TEXTURE, 1, PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+    circle = LoadTextureFromImage(image);
+    GenTextureMipmaps(&circle);
+    SetTextureFilter(circle, TEXTURE_FILTER_TRILINEAR);
+
+    // empty cells stay clear, the rest go from a faint blue to an opaque red
+    palette[0] = BLANK;
+    for (int level = 1; level < 256; level++) {
+        Color color = ColorFromHSV(240 * (1 - level / 255.0f), 1, 1);
+        color.a = 96 + level * 159 / 255;
+        palette[level] = color;
+    }
+}
+
+WorldRenderer::~WorldRenderer() {
+    UnloadTexture(circle);
+    if (grid.id != 0) UnloadRenderTexture(grid);
+    if (heatmap.id != 0) UnloadTexture(heatmap);
+}
+
+void WorldRenderer::invalidateGrid(void) { gridCellSize = 0; }
+
+void WorldRenderer::setGridVisible(bool visible) { gridVisible = visible; }
+
+bool WorldRenderer::isGridVisible(void) const { return gridVisible; }
+
+// the lines of the cells in view, clipped to it
+static void drawGridLines(Vec2<int> constraint, int cellSize, Rectangle view) {
+    float left = std::max(0.0f, view.x), right = std::min((float)constraint.x, view.x + view.width);
+    float top = std::max(0.0f, view.y), bottom = std::min((float)constraint.y, view.y + view.height);
+    int lastColumn = std::min(constraint.x / cellSize - 1, (int)(right / cellSize));
+    for (int i = std::max(0, (int)ceilf(left / cellSize)); i <= lastColumn; i++) {
+        DrawLine(i * cellSize, top, i * cellSize, bottom, GRAY);
+    }
+    int lastRow = std::min(constraint.y / cellSize - 1, (int)(bottom / cellSize));
+    for (int j = std::max(0, (int)ceilf(top / cellSize)); j <= lastRow; j++) {
+        DrawLine(left, j * cellSize, right, j * cellSize, GRAY);
+    }
+}
+
+void WorldRenderer::drawGrid(CollidingWorld const &world, Rectangle view) {
+    auto constraint = world.getWorldConstraint();
+    auto cellSize = world.getCellSize();
+    if (cellSize != gridCellSize || constraint.x != gridSize.x || constraint.y != gridSize.y) {
+        bool fits = constraint.x <= GRID_TEXTURE_MAX && constraint.y <= GRID_TEXTURE_MAX;
+        if (grid.id != 0 && (!fits || grid.texture.width != constraint.x || grid.texture.height != constraint.y)) {
+            UnloadRenderTexture(grid);
+            grid = {};
+        }
+        if (fits && grid.id == 0) grid = LoadRenderTexture(constraint.x, constraint.y);
+        if (grid.id != 0 && grid.texture.id == 0) {
+            UnloadRenderTexture(grid);
+            grid = {};
+        }
+        if (grid.id != 0) {
+            BeginTextureMode(grid);
+            ClearBackground(BLANK);
+            drawGridLines(constraint, cellSize, {0, 0, (float)constraint.x, (float)constraint.y});
+            EndTextureMode();
+        }
+        gridCellSize = cellSize;
+        gridSize = constraint;
+    }
+    // a world too big for a texture gets the lines in view drawn every frame
+    if (grid.id == 0) {
+        drawGridLines(constraint, cellSize, view);
+        return;
+    }
+    // render textures come out upside down, a negative source height flips them back
+    DrawTextureRec(grid.texture, {0, 0, (float)grid.texture.width, -(float)grid.texture.height}, {0, 0}, WHITE);
+}
+
+void WorldRenderer::drawHeatmap(CollidingWorld const &world, Rectangle view, float zoom) {
+    auto &cellStart = world.getSnapshot().cellStart;
+    auto cellSize = world.getCellSize();
+    auto [columns, rows] = world.getGridSize();
+    // rows here are the grid's, which starts at the world's row top
+    int top = world.getFirstRow();
+    // blocks of stride x stride cells, lined up with the grid so they do not shimmer while panning
+    int stride = std::max(1, (int)ceilf(HEATMAP_TEXEL / (cellSize * zoom)));
+    int firstColumn = std::max(0, (int)floorf(view.x / cellSize)) / stride * stride;
+    int firstRow = std::max(0, (int)floorf(view.y / cellSize) - top) / stride * stride;
+    int lastColumn = std::min(columns - 1, (int)floorf((view.x + view.width) / cellSize));
+    int lastRow = std::min(rows - 1, (int)floorf((view.y + view.height) / cellSize) - top);
+    if (lastColumn < firstColumn || lastRow < firstRow) return;
+    int width = (lastColumn - firstColumn) / stride + 1, height = (lastRow - firstRow) / stride + 1;
+
+    heatCounts.assign(width * height, 0);
+    for (int row = firstRow; row <= lastRow; row++) {
+        auto counts = heatCounts.data() + (row - firstRow) / stride * width;
+        auto start = cellStart.data() + row * columns;
+        for (int column = firstColumn; column <= lastColumn; column++) {
+            counts[(column - firstColumn) / stride] += start[column + 1] - start[column];
+        }
+    }
+
+    // levels go by the log of the count, so a few packed cells do not wash out everything else
+    uint32_t most = *std::max_element(heatCounts.begin(), heatCounts.end());
+    float scale = most > 0 ? 255 / log2f(most + 1.0f) : 0;
+    heatPixels.resize(width * height);
+    for (int i = 0; i < width * height; i++) {
+        heatPixels[i] = palette[std::min(255, (int)ceilf(log2f(heatCounts[i] + 1.0f) * scale))];
+    }
+
+    if (heatmap.id == 0 || heatmap.width < width || heatmap.height < height) {
+        Image image = {nullptr, std::max(width, heatmap.width), std::max(height, heatmap.height), 1,
+                       PIXELFORMAT_UNCOMPRESSED_R8G8B8A8};
+        std::vector<Color> blank(image.width * image.height, BLANK);
+        image.data = blank.data();
+        if (heatmap.id != 0) UnloadTexture(heatmap);
+        heatmap = LoadTextureFromImage(image);
+    }
+    UpdateTextureRec(heatmap, {0, 0, (float)width, (float)height}, heatPixels.data());
+    float block = stride * cellSize;
+    Rectangle dest = {(float)firstColumn * cellSize, (float)(top + firstRow) * cellSize, width * block, height * block};
+    DrawTexturePro(heatmap, {0, 0, (float)width, (float)height}, dest, {0, 0}, 0, WHITE);
+}
+
+void WorldRenderer::drawBall(BallSprite const &sprite, float zoom) {
+    if (sprite.radius * zoom < POINT_RADIUS) {
+        // A pixel sized quad of the solid middle of the circle. It keeps to the texture the other balls use,
+        // so points and circles still go out in the same batch.
+        float size = 1 / zoom;
+        Rectangle dest = {sprite.pos.x - size / 2, sprite.pos.y - size / 2, size, size};
+        Rectangle source = {CIRCLE_TEXTURE / 2 - 1, CIRCLE_TEXTURE / 2 - 1, 2, 2};
+        DrawTexturePro(circle, source, dest, {0, 0}, 0, sprite.color);
+        return;
+    }
+    // the quad is a little bigger than the ball, by the border the texture leaves around the circle
+    float size = 2 * sprite.radius * (CIRCLE_TEXTURE / (2 * CIRCLE_RADIUS));
+    Rectangle dest = {sprite.pos.x - size / 2, sprite.pos.y - size / 2, size, size};
+    DrawTexturePro(circle, {0, 0, (float)circle.width, (float)circle.height}, dest, {0, 0}, 0, sprite.color);
+}
+
+void WorldRenderer::draw(CollidingWorld const &world) {
+    auto [wx, wy] = world.getWorldConstraint();
+    draw(world, {0, 0, (float)wx, (float)wy});
+}
+
+void WorldRenderer::draw(CollidingWorld const &world, Rectangle view, float zoom) {
+    auto &snapshot = world.getSnapshot();
+    auto &sprites = snapshot.sprites;
+    if (snapshot.cellStart.empty()) return;
+
+    // zoomed out this far the cost goes by the cells in view, however many balls they hold
+    if (world.getCellSize() * zoom < HEATMAP_CELL) {
+        drawHeatmap(world, view, zoom);
+    } else {
+        if (gridVisible) drawGrid(world, view);
+        world.forEachSpriteRange(view, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) drawBall(sprites[i], zoom);
+        });
+    }
+    // balls outside the grid, there are hardly ever any
+    for (size_t i = snapshot.cellStart.back(); i < sprites.size(); i++) drawBall(sprites[i], zoom);
+}
+
+#endif  // BALLS_HEADLESS
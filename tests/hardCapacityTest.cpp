@@ -0,0 +1,48 @@
+// Reserves a hard capacity below the balls a world already holds, and checks that new balls are dropped until
+// enough of the old ones are removed, while the old ones stay.
+
+#include <cstdio>
+
+#include "balls.hpp"
+
+static int failures = 0;
+
+static void expect(CollidingWorld const &world, int balls, size_t dropped, char const *when) {
+    if (world.getBallCount() == balls && world.getDroppedCount() == dropped) return;
+    std::printf("%s: %d balls and %zu dropped, expected %d and %zu\n", when, world.getBallCount(),
+                world.getDroppedCount(), balls, dropped);
+    failures++;
+}
+
+static Ball ball(int id) { return Ball(id, 3, 1, RED, {(float)(id % 40 * 20 + 10), 100}, {0, 0}, {0, 0}); }
+
+int main(void) {
+    CollidingWorld world(20, {800, 800}, 1);
+    for (int id = 0; id < 10; id++) world.addBall(ball(id));
+    world.update(Vector2Zero(), false, 0);
+
+    world.reserve(5, 0, true);
+    world.update(Vector2Zero(), false, 0);
+    expect(world, 10, 0, "after the reserve");
+
+    world.addBall(ball(10));
+    world.update(Vector2Zero(), false, 0);
+    expect(world, 10, 1, "adding past the capacity");
+
+    // replacing a ball that is there does not need room
+    world.addBall(ball(3));
+    world.update(Vector2Zero(), false, 0);
+    expect(world, 10, 1, "replacing a ball");
+
+    for (int id = 0; id < 6; id++) world.removeBall(id);
+    world.update(Vector2Zero(), false, 0);
+    expect(world, 4, 1, "after removing below the capacity");
+
+    std::vector<Ball> batch = {ball(11), ball(12)};
+    world.addBalls(batch);
+    world.update(Vector2Zero(), false, 0);
+    expect(world, 5, 2, "adding up to the capacity");
+
+    std::printf("%s\n", failures == 0 ? "ok" : "failed");
+    return failures == 0 ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+// Steps balls that cross the edge between two strips faster than a cell per step, and checks that the strips
+// end up with them where a single world does, each on exactly one rank.
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "stripDomain.hpp"
+
+constexpr int CELL_SIZE = 50;
+constexpr Vec2<int> WORLD = {1000, 1000};
+constexpr int STEPS = 3;
+constexpr float DT = 1 / 60.0f;
+
+static std::vector<Ball> setup(void) {
+    return {
+        Ball(0, 10, 1, RED, {300, 480}, {0, 6000}, {0, 0}),
+        Ball(1, 10, 1, BLUE, {700, 560}, {0, -6000}, {0, 0}),
+        // slow enough to only just cross
+        Ball(2, 10, 1, GREEN, {500, 495}, {0, 600}, {0, 0}),
+    };
+}
+
+int main(void) {
+    auto transport = SocketTransport::forkLocal(2);
+    std::vector<Ball> owned;
+    {
+        StripDomain strip(*transport, CELL_SIZE, WORLD, 1);
+        for (auto &ball : setup()) strip.addBall(ball);
+        for (int i = 0; i < STEPS; i++) strip.step(DT, false);
+        auto &world = strip.getWorld();
+        for (int i = 0; i < world.getBallCount(); i++) {
+            auto ball = world.getBallAt(i);
+            // ghosts are the only balls that are not integrated
+            if (ball.shouldUpdate) owned.push_back(ball);
+        }
+    }
+
+    // rank 1 hands its balls to rank 0, which checks them all
+    std::vector<char> bytes(owned.size() * sizeof(Ball));
+    if (!owned.empty()) std::memcpy(bytes.data(), owned.data(), bytes.size());
+    std::vector<Transport::Exchange> exchanges = {{1 - transport->getRank(), bytes, {}}};
+    transport->exchange(exchanges);
+    if (transport->getRank() != 0) return 0;
+    std::vector<Ball> others(exchanges[0].in.size() / sizeof(Ball), Ball(0, 0, 0, {}, {}, {}, {}));
+    if (!others.empty()) std::memcpy(others.data(), exchanges[0].in.data(), exchanges[0].in.size());
+    owned.insert(owned.end(), others.begin(), others.end());
+    transport.reset();
+
+    CollidingWorld single(CELL_SIZE, WORLD, 1);
+    for (auto &ball : setup()) single.addBall(ball);
+    for (int i = 0; i < STEPS; i++) single.update(Vector2Zero(), false, DT);
+
+    int failures = 0;
+    if ((int)owned.size() != single.getBallCount()) {
+        std::printf("the strips have %d balls, a single world has %d\n", (int)owned.size(), single.getBallCount());
+        failures++;
+    }
+    for (int i = 0; i < single.getBallCount(); i++) {
+        auto expected = single.getBallAt(i);
+        int found = 0;
+        for (auto &ball : owned) {
+            if (ball.id != expected.id) continue;
+            found++;
+            if (std::fabs(ball.pos.y - expected.pos.y) > 1e-3f || std::fabs(ball.vel.y - expected.vel.y) > 1e-3f) {
+                std::printf("ball %d is at y %g going %g, a single world has it at y %g going %g\n", ball.id,
+                            ball.pos.y, ball.vel.y, expected.pos.y, expected.vel.y);
+                failures++;
+            }
+        }
+        if (found != 1) {
+            std::printf("ball %d is on %d ranks\n", expected.id, found);
+            failures++;
+        }
+    }
+    std::printf("%s\n", failures == 0 ? "ok" : "failed");
+    return failures == 0 ? 0 : 1;
+}
\ No newline at end of file